@@ -0,0 +1,69 @@
+//
+// LD_PRELOAD library simulating a slow filesystem for bench-slow-fs.py: open() (and fopen(), used by
+// std::ifstream) of every path containing "/slow/" sleeps for SLOW_OPEN_MS milliseconds (environment variable, 2000 by default) before opening the file.
+// Build: cc -shared -fPIC -o bench-slow-fs.so bench-slow-fs.c -ldl
+//
+
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static void delay_if_slow(const char *path) {
+    if (strstr(path, "/slow/") == NULL)
+        return;
+    const char *delay_ms = getenv("SLOW_OPEN_MS");
+    long ms = delay_ms != NULL ? atol(delay_ms) : 2000;
+    struct timespec delay = {ms / 1000, (ms % 1000) * 1000000};
+    while (nanosleep(&delay, &delay) != 0) {}
+}
+
+// Mode is passed only when a file may be created.
+static mode_t get_mode(int flags, va_list args) {
+    return (flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE ? va_arg(args, mode_t) : 0;
+}
+
+int open(const char *path, int flags, ...) {
+    static int (*real_open)(const char *, int, ...) = NULL;
+    if (real_open == NULL)
+        real_open = dlsym(RTLD_NEXT, "open");
+    va_list args;
+    va_start(args, flags);
+    mode_t mode = get_mode(flags, args);
+    va_end(args);
+    delay_if_slow(path);
+    return real_open(path, flags, mode);
+}
+
+int open64(const char *path, int flags, ...) {
+    static int (*real_open64)(const char *, int, ...) = NULL;
+    if (real_open64 == NULL)
+        real_open64 = dlsym(RTLD_NEXT, "open64");
+    va_list args;
+    va_start(args, flags);
+    mode_t mode = get_mode(flags, args);
+    va_end(args);
+    delay_if_slow(path);
+    return real_open64(path, flags, mode);
+}
+
+FILE *fopen(const char *path, const char *mode) {
+    static FILE *(*real_fopen)(const char *, const char *) = NULL;
+    if (real_fopen == NULL)
+        real_fopen = dlsym(RTLD_NEXT, "fopen");
+    delay_if_slow(path);
+    return real_fopen(path, mode);
+}
+
+FILE *fopen64(const char *path, const char *mode) {
+    static FILE *(*real_fopen64)(const char *, const char *) = NULL;
+    if (real_fopen64 == NULL)
+        real_fopen64 = dlsym(RTLD_NEXT, "fopen64");
+    delay_if_slow(path);
+    return real_fopen64(path, mode);
+}
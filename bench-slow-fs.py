@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+#
+# Measures how the server copes with a slow filesystem. bench-slow-fs.c (loaded with LD_PRELOAD)
+# delays open() of files under "/slow/" by SLOW_OPEN_MS. While PARALLEL_SLOW clients request different
+# slow files at once, other clients keep requesting fast files. Reports how long the slow requests took
+# (with a pool that grows they overlap, so this should be close to one delay) and the latency of the fast
+# requests, which shouldn't be affected at all.
+# Usage: ./bench-slow-fs.py [<path-to-serwer>]
+#
+
+import http.client
+import sys
+import threading
+import time
+
+import serwer_test
+
+SLOW_OPEN_MS = 1000
+PARALLEL_SLOW = 8
+ROUNDS = 3
+FAST_CLIENTS = 2
+
+
+def get(port, path):
+    connection = http.client.HTTPConnection("127.0.0.1", port, timeout=30)
+    try:
+        connection.request("GET", path)
+        response = connection.getresponse()
+        response.read()
+        return response.status
+    finally:
+        connection.close()
+
+
+def main():
+    binary = sys.argv[1] if len(sys.argv) > 1 else serwer_test.build()
+    sizes = {"/fast/file": 1000}
+    sizes.update({"/slow/file%02d" % i: 1000 for i in range(PARALLEL_SLOW * ROUNDS)})
+    base_dir, servers_file = serwer_test.make_files(sizes)
+    server = serwer_test.Server(binary, base_dir, servers_file, preload=serwer_test.build_slow_fs_shim(),
+                                env={"SLOW_OPEN_MS": str(SLOW_OPEN_MS)})
+    fast = serwer_test.Load(server.port, ["/fast/file"], clients=FAST_CLIENTS, keep_alive=True).start()
+
+    statuses = []
+    durations = []
+    for round_index in range(ROUNDS):
+        paths = ["/slow/file%02d" % (round_index * PARALLEL_SLOW + i) for i in range(PARALLEL_SLOW)]
+        threads = [threading.Thread(target=lambda path=path: statuses.append(get(server.port, path)))
+                   for path in paths]
+        start = time.time()
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        durations.append(time.time() - start)
+    fast.stop()
+    server.stop()
+
+    if any(status != 200 for status in statuses) or fast.failed > 0:
+        sys.exit("FAIL: some requests failed")
+    latencies = [latency for end, latency in fast.latencies]
+    print("%d parallel slow lookups (open() delayed by %d ms): %s s" % (
+        PARALLEL_SLOW, SLOW_OPEN_MS, ", ".join("%.2f" % duration for duration in durations)))
+    print("fast requests meanwhile: %d, p50 %.2f ms, p99 %.2f ms, max %.2f ms" % (
+        len(latencies), serwer_test.percentile(latencies, 50) * 1000, serwer_test.percentile(latencies, 99) * 1000,
+        max(latencies) * 1000))
+
+
+if __name__ == "__main__":
+    main()
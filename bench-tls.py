@@ -0,0 +1,50 @@
+#!/usr/bin/env python3
+#
+# Compares download throughput over HTTPS with kTLS enabled (when the kernel supports it) and disabled
+# with SERWER_KTLS=0, with plain HTTP as a reference. Reports whether kTLS was actually used.
+# Usage: ./bench-tls.py [<path-to-serwer>]
+#
+
+import os
+import ssl
+import sys
+import time
+
+import serwer_test
+
+DURATION = 5.0
+CLIENTS = 4
+FILE_SIZES = {"/big": 16 * 1024 * 1024}
+
+
+def measure(binary, base_dir, servers_file, env, tls_context):
+    server = serwer_test.Server(binary, base_dir, servers_file, env=env)
+    load = serwer_test.Load(server.port, list(FILE_SIZES), clients=CLIENTS, keep_alive=True,
+                            tls_context=tls_context, expected_sizes=FILE_SIZES).start()
+    time.sleep(DURATION)
+    load.stop()
+    server.stop()
+    if load.failed > 0:
+        sys.exit("FAIL: %d requests failed: %s" % (load.failed, load.errors[:3]))
+    log = server.read_log()
+    ktls = "kTLS enabled" if "kTLS enabled" in log else "kTLS not used" if "kTLS not available" in log else ""
+    return load.ok * FILE_SIZES["/big"] / DURATION / 2 ** 20, ktls
+
+
+def main():
+    binary = sys.argv[1] if len(sys.argv) > 1 else serwer_test.build()
+    base_dir, servers_file = serwer_test.make_files(FILE_SIZES)
+    cert, key = serwer_test.make_certificate(os.path.dirname(base_dir))
+    tls_context = ssl.create_default_context(cafile=cert)
+    variants = [
+        ("HTTP", {}, None),
+        ("HTTPS, kTLS allowed", serwer_test.tls_env(cert, key), tls_context),
+        ("HTTPS, SERWER_KTLS=0", dict(serwer_test.tls_env(cert, key), SERWER_KTLS="0"), tls_context),
+    ]
+    for name, env, context in variants:
+        throughput, ktls = measure(binary, base_dir, servers_file, env, context)
+        print("%-22s %8.1f MiB/s  %s" % (name, throughput, ktls))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,50 @@
+#!/usr/bin/env python3
+#
+# Measures the cost of tracing: throughput and latency of a default build, of a TRACE=1 build
+# with tracing disabled at runtime and of a TRACE=1 build run with SERWER_TRACE=1.
+# Usage: ./bench-trace.py
+#
+
+import statistics
+import sys
+import time
+
+import serwer_test
+
+DURATION = 5.0
+RUNS = 3
+CLIENTS = 4
+FILE_SIZES = {"/small": 4096, "/medium": 64 * 1024}
+
+
+def measure(binary, base_dir, servers_file, env):
+    server = serwer_test.Server(binary, base_dir, servers_file, env=env)
+    load = serwer_test.Load(server.port, list(FILE_SIZES), clients=CLIENTS, keep_alive=True,
+                            expected_sizes=FILE_SIZES).start()
+    time.sleep(DURATION)
+    load.stop()
+    server.stop()
+    if load.failed > 0:
+        sys.exit("FAIL: %d requests failed: %s" % (load.failed, load.errors[:3]))
+    latencies = [latency for end, latency in load.latencies]
+    return load.ok / DURATION, serwer_test.percentile(latencies, 50), serwer_test.percentile(latencies, 99)
+
+
+def main():
+    default_binary = serwer_test.build()
+    trace_binary = serwer_test.build(["TRACE=1"])
+    base_dir, servers_file = serwer_test.make_files(FILE_SIZES)
+    variants = [
+        ("default build", default_binary, {}),
+        ("TRACE=1, tracing off", trace_binary, {}),
+        ("TRACE=1, SERWER_TRACE=1", trace_binary, {"SERWER_TRACE": "1"}),
+    ]
+    for name, binary, env in variants:
+        results = [measure(binary, base_dir, servers_file, env) for _ in range(RUNS)]
+        print("%-24s %8.0f req/s  p50 %6.3f ms  p99 %6.3f ms  (median of %d runs)" % (
+            name, statistics.median(r[0] for r in results), statistics.median(r[1] for r in results) * 1000,
+            statistics.median(r[2] for r in results) * 1000, RUNS))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+#
+# Measures how fast the p99 latency settles after a cold start, with and without the page cache warm-up.
+# A training run records popularity of files in SERWER_WARMUP_LIST. Before every measured run the files
+# are evicted from the page cache (posix_fadvise(DONTNEED)), then the server is started either without
+# the warm-up or with the recorded list, and clients request files with a skewed (Zipf-like) popularity.
+# Usage: ./bench-warmup.py [<path-to-serwer>]
+#
+
+import os
+import random
+import sys
+import time
+
+import serwer_test
+
+FILES_COUNT = 400
+FILE_SIZE = 256 * 1024
+CLIENTS = 8
+TRAINING_DURATION = 3.0
+DURATION = 6.0
+WINDOW = 0.5  # Length of the windows in which p99 is computed, in seconds.
+# The latency has settled when p99 of a window is at most this many times the steady state p99.
+SETTLED_FACTOR = 2.0
+
+
+def request_sequence(paths, length=20000):
+    random.seed(1)
+    weights = [1.0 / (rank + 1) for rank in range(len(paths))]
+    return random.choices(paths, weights=weights, k=length)
+
+
+def evict(base_dir):
+    for name in os.listdir(base_dir):
+        fd = os.open(os.path.join(base_dir, name), os.O_RDONLY)
+        os.fsync(fd)  # Dirty pages can't be evicted.
+        os.posix_fadvise(fd, 0, 0, os.POSIX_FADV_DONTNEED)
+        os.close(fd)
+
+
+def run(binary, base_dir, servers_file, sequence, duration, env=None):
+    server = serwer_test.Server(binary, base_dir, servers_file, env=env)
+    start = time.time()
+    load = serwer_test.Load(server.port, sequence, clients=CLIENTS, keep_alive=True).start()
+    time.sleep(duration)
+    load.stop()
+    server.stop()
+    if load.failed > 0:
+        sys.exit("FAIL: %d requests failed: %s" % (load.failed, load.errors[:3]))
+    return start, load.latencies
+
+
+def report(name, start, latencies):
+    windows = {}
+    for end, latency in latencies:
+        windows.setdefault(int((end - start) / WINDOW), []).append(latency)
+    steady = serwer_test.percentile([latency for end, latency in latencies if end - start >= DURATION / 2], 99)
+    first_second = serwer_test.percentile([latency for end, latency in latencies if end - start < 1.0], 99)
+    settled_at = None
+    for index in sorted(windows, reverse=True):
+        if serwer_test.percentile(windows[index], 99) > SETTLED_FACTOR * steady:
+            settled_at = (index + 1) * WINDOW
+            break
+    print("%-8s requests %6d  p99 first second %7.2f ms  p99 steady %6.2f ms  settled after %s" % (
+        name, len(latencies), first_second * 1000, steady * 1000,
+        "%.1f s" % settled_at if settled_at is not None else "0.0 s"))
+
+
+def main():
+    binary = sys.argv[1] if len(sys.argv) > 1 else serwer_test.build()
+    sizes = {"/file%03d" % i: FILE_SIZE for i in range(FILES_COUNT)}
+    base_dir, servers_file = serwer_test.make_files(sizes)
+    list_path = os.path.join(os.path.dirname(base_dir), "popularity.txt")
+    sequence = request_sequence(sorted(sizes))
+
+    run(binary, base_dir, servers_file, sequence, TRAINING_DURATION, env={"SERWER_WARMUP_LIST": list_path})
+    if not os.path.exists(list_path):
+        sys.exit("FAIL: the training run didn't save the popularity list")
+
+    evict(base_dir)
+    report("cold", *run(binary, base_dir, servers_file, sequence, DURATION))
+    evict(base_dir)
+    report("warm-up", *run(binary, base_dir, servers_file, sequence, DURATION,
+                           env={"SERWER_WARMUP_LIST": list_path}))
+
+
+if __name__ == "__main__":
+    main()
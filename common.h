@@ -0,0 +1,14 @@
+#ifndef ZADANIE_1_COMMON_H
+#define ZADANIE_1_COMMON_H
+
+#include <string>
+
+// Definitions shared by the modules of the server, which don't need the rest of server.h.
+
+// Maximal number of bytes read from a client at once.
+#define READ_BUFFER_SIZE 4096
+
+// Prints message to stderr and exits program with code EXIT_FAILURE.
+void exit_error(const std::string &message);
+
+#endif //ZADANIE_1_COMMON_H
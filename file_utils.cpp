@@ -0,0 +1,27 @@
+#include "file_utils.h"
+#include "trace.h"
+
+#include <algorithm>
+
+bool file_utils::is_subpath_of(const std::string &canonized_base, const std::string &uncanonized_sub) {
+    std::string canonized_sub;
+    try {
+        canonized_sub = file_utils::canonize(uncanonized_sub);
+    } catch (const file_utils::NoDirException &noDirException) {
+        return false;
+    }
+    auto m = std::mismatch(canonized_base.begin(), canonized_base.end(),
+                           canonized_sub.begin(), canonized_sub.end());
+    return m.first == canonized_base.end();
+}
+
+std::string file_utils::canonize(const std::string &path) {
+    TRACE_STAGE("canonize");
+    std::string p;
+    try {
+        p = file_utils::fs::canonical(path);
+    } catch (...) {
+        throw file_utils::NoDirException();
+    }
+    return p;
+}
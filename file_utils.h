@@ -0,0 +1,27 @@
+#ifndef ZADANIE_1_FILE_UTILS_H
+#define ZADANIE_1_FILE_UTILS_H
+
+#include <experimental/filesystem>
+#include <string>
+
+namespace file_utils {
+    namespace fs = std::experimental::filesystem;
+
+    // Returns string containing canonized path.
+    // Does it using filesystem::canonize() method.
+    // Throws NoDirException if canonizing failed (path doesn't exist).
+    std::string canonize(const std::string &path);
+
+    // Returns 'true' if directory uncanonized_sub is contained in the 'canonized_base'.
+    // As the parameter name suggest, canonized_base should contain canonicalized version of path.
+    bool is_subpath_of(const std::string &canonized_base, const std::string &uncanonized_sub);
+
+    class NoDirException : public std::exception {
+    public:
+        [[nodiscard]] const char *what() const noexcept override {
+            return "Directory not found!";
+        }
+    };
+}
+
+#endif //ZADANIE_1_FILE_UTILS_H
@@ -0,0 +1,167 @@
+#include "fs_pool.h"
+#include "common.h"
+
+#include <iostream>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+FsPool::FsPool() {
+    event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fd < 0)
+        exit_error("eventfd error");
+    for (int i = 0; i < POOL_MAX_THREADS; i++)
+        slots.push_back(std::make_unique<Slot>());
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (int i = 0; i < POOL_MIN_THREADS; i++)
+        spawn_thread();
+    monitor_thread = std::thread(&FsPool::monitor, this);
+}
+
+FsPool::~FsPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopped = true;
+    }
+    workers_cv.notify_all();
+    monitor_cv.notify_all();
+    monitor_thread.join();
+    for (auto &slot : slots) {
+        if (slot->thread.joinable())
+            slot->thread.join();
+    }
+    close(event_fd);
+}
+
+void FsPool::spawn_thread() {
+    for (size_t id = 0; id < slots.size(); id++) {
+        Slot &slot = *slots[id];
+        if (slot.is_active)
+            continue;
+        // Thread that served this slot before has already decided to exit.
+        if (slot.thread.joinable())
+            slot.thread.join();
+        slot.is_active = true;
+        slot.thread = std::thread(&FsPool::work, this, id);
+        threads_count++;
+        return;
+    }
+}
+
+bool FsPool::take_task(size_t id, Task &task) {
+    for (size_t i = 0; i < slots.size(); i++) {
+        Slot &slot = *slots[(id + i) % slots.size()];
+        std::lock_guard<std::mutex> lock(slot.mutex);
+        if (slot.tasks.empty())
+            continue;
+        if (i == 0) { // Own queue, oldest task first.
+            task = std::move(slot.tasks.front());
+            slot.tasks.pop_front();
+        } else { // Stealing, from the other end.
+            task = std::move(slot.tasks.back());
+            slot.tasks.pop_back();
+        }
+        return true;
+    }
+    return false;
+}
+
+FsPool::clock::duration FsPool::oldest_task_delay() {
+    auto now = clock::now();
+    clock::duration delay = clock::duration::zero();
+    for (auto &slot : slots) {
+        std::lock_guard<std::mutex> lock(slot->mutex);
+        if (!slot->tasks.empty())
+            delay = std::max(delay, now - slot->tasks.front().submit_time);
+    }
+    return delay;
+}
+
+void FsPool::work(size_t id) {
+    for (;;) {
+        Task task;
+        if (take_task(id, task)) {
+            pending--;
+            task.work();
+            {
+                std::lock_guard<std::mutex> completions_lock(completions_mutex);
+                completions.push_back(std::move(task.done));
+            }
+            uint64_t one = 1;
+            if (write(event_fd, &one, sizeof(one)) != sizeof(one))
+                std::cerr << "Error writing to eventfd!" << std::endl;
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        if (stopped && pending == 0)
+            break;
+        // 'pending' may be positive while the queues are empty for a moment (a task is being queued,
+        // or another thread has just taken the last one), then the thread tries again right away.
+        idle_count++;
+        bool has_task = workers_cv.wait_for(lock, std::chrono::milliseconds(POOL_IDLE_TIMEOUT_MS),
+                                            [this] { return stopped || pending > 0; });
+        idle_count--;
+        if (!has_task && threads_count > POOL_MIN_THREADS)
+            break;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    // Tasks submitted to this slot in the meantime are stolen by the other threads.
+    slots[id]->is_active = false;
+    threads_count--;
+}
+
+void FsPool::monitor() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopped) {
+        if (pending == 0) {
+            monitor_cv.wait(lock, [this] { return stopped || pending > 0; });
+            continue;
+        }
+        monitor_cv.wait_for(lock, std::chrono::milliseconds(POOL_GROW_DELAY_MS));
+        if (!stopped && pending > 0 && idle_count == 0 && threads_count < POOL_MAX_THREADS &&
+            oldest_task_delay() >= std::chrono::milliseconds(POOL_GROW_DELAY_MS))
+            spawn_thread();
+    }
+}
+
+void FsPool::submit(std::function<void()> work, std::function<void()> done) {
+    // Submitting to the next active slot, so that tasks are spread between the threads.
+    // There is always at least POOL_MIN_THREADS active one; if it has just stopped, its task is stolen.
+    Slot *slot = slots[next_slot].get();
+    for (size_t i = 0; i < slots.size() && !slot->is_active; i++) {
+        next_slot = (next_slot + 1) % slots.size();
+        slot = slots[next_slot].get();
+    }
+    next_slot = (next_slot + 1) % slots.size();
+
+    bool was_empty = pending++ == 0;
+    {
+        std::lock_guard<std::mutex> slot_lock(slot->mutex);
+        slot->tasks.push_back({std::move(work), std::move(done), clock::now()});
+    }
+    bool has_idle = idle_count > 0;
+    if (!has_idle && !was_empty)
+        return; // Busy threads take the task without being woken up.
+    // Waiting threads check 'pending' with the mutex locked, so after it has been released
+    // they are either asleep and get notified, or will see the new task.
+    { std::lock_guard<std::mutex> lock(mutex); }
+    if (has_idle)
+        workers_cv.notify_one();
+    if (was_empty)
+        monitor_cv.notify_one();
+}
+
+void FsPool::run_completions() {
+    uint64_t count;
+    if (read(event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        exit_error("Error reading from eventfd!");
+
+    std::deque<std::function<void()>> ready;
+    {
+        std::lock_guard<std::mutex> lock(completions_mutex);
+        ready.swap(completions);
+    }
+    for (auto &done : ready)
+        done();
+}
@@ -0,0 +1,102 @@
+#ifndef ZADANIE_1_FS_POOL_H
+#define ZADANIE_1_FS_POOL_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define POOL_MIN_THREADS 1
+#define POOL_MAX_THREADS 16
+// The pool grows when the oldest waiting task has been waiting for longer than this.
+#define POOL_GROW_DELAY_MS 5
+// Threads idle for longer than this exit (as long as there are more than POOL_MIN_THREADS of them).
+#define POOL_IDLE_TIMEOUT_MS 5000
+
+// Thread pool for blocking filesystem work, so that it doesn't stall the event loop.
+// Every thread has its own task queue; idle threads steal tasks from the queues of the others.
+// Submitting and taking tasks only lock the queue they use; the pool-wide mutex is taken
+// only to put threads to sleep, wake them up and start or stop them.
+// The number of threads adapts to the load: it grows when tasks wait too long to be started
+// and shrinks when threads stay idle.
+// Completions are run on the thread owning the pool: it should poll get_event_fd() and call
+// run_completions() when the descriptor is readable.
+class FsPool {
+    using clock = std::chrono::steady_clock;
+
+    struct Task {
+        std::function<void()> work, done;
+        clock::time_point submit_time;
+    };
+
+    // Task queue of one thread.
+    struct Slot {
+        std::mutex mutex; // Guards 'tasks'.
+        std::deque<Task> tasks;
+        std::atomic<bool> is_active = false; // Whether a thread is serving this slot.
+        std::thread thread;
+    };
+
+    std::vector<std::unique_ptr<Slot>> slots;
+    // Number of tasks in all queues. Increased before a task is queued, so it is never lower
+    // than the number of tasks that can be taken.
+    std::atomic<size_t> pending = 0;
+    std::atomic<size_t> idle_count = 0; // Number of threads waiting for tasks.
+    // Guards fields below and 'thread' of the slots (and changes of 'is_active'). Threads wait
+    // for tasks with it locked, so it is locked before notifying them.
+    std::mutex mutex;
+    std::condition_variable workers_cv, monitor_cv;
+    size_t threads_count = 0;
+    bool stopped = false;
+    size_t next_slot = 0; // Slot to which the next task is submitted, used only by submit().
+    std::thread monitor_thread;
+
+    int event_fd;
+    std::mutex completions_mutex;
+    std::deque<std::function<void()>> completions;
+
+    // Starts a thread in some inactive slot. Expects 'mutex' to be locked.
+    void spawn_thread();
+
+    // Takes a task from the queue of slot 'id' or steals one from another queue.
+    // Returns 'false' if all queues are empty.
+    bool take_task(size_t id, Task &task);
+
+    // Returns how long the oldest queued task has been waiting. Expects 'mutex' to be locked.
+    clock::duration oldest_task_delay();
+
+    // Main function of the thread serving slot 'id'.
+    void work(size_t id);
+
+    // Grows the pool when tasks wait for too long.
+    void monitor();
+
+public:
+    FsPool();
+
+    FsPool(const FsPool &) = delete;
+
+    FsPool &operator=(const FsPool &) = delete;
+
+    // Waits for all submitted tasks to finish. Completions that have not been run yet are dropped.
+    ~FsPool();
+
+    // Runs 'work' on one of the pool threads. Afterwards 'done' is run by run_completions().
+    // Has to be called from the thread owning the pool.
+    void submit(std::function<void()> work, std::function<void()> done);
+
+    // Returns eventfd descriptor which is readable when some completions are waiting to be run.
+    [[nodiscard]] int get_event_fd() const {
+        return event_fd;
+    }
+
+    // Runs completions of finished tasks.
+    void run_completions();
+};
+
+#endif //ZADANIE_1_FS_POOL_H
@@ -3,6 +3,10 @@
 //
 
 #include "http.h"
+#include "tls.h"
+#include "trace.h"
+
+#include <cerrno>
 
 std::string http::create_header(const std::string &field_name, const std::string &field_value) {
     return field_name + ":" + field_value + http::SP + http::CRLF;
@@ -18,33 +22,75 @@ void Response::set_file_descriptor(int file_descriptor, size_t file_size) {
     is_sending_file = true;
 }
 
-bool Response::send(int msg_sock) {
-    std::string response_start =
-            http::HTTP_VERSION + http::SP + std::to_string(status) + http::SP + reason_phrase + http::CRLF + headers + http::CRLF;
-    if (write(msg_sock, response_start.c_str(), response_start.size()) != (ssize_t) response_start.size()) {
-        std::cout << "Error sending response!" << std::endl;
-        if (is_sending_file)
-            close(file_descriptor);
-        return false;
+int Response::send(int msg_sock, tls::Session *tls_session) {
+    TRACE_STAGE("send");
+    if (response_start.empty())
+        response_start = http::HTTP_VERSION + http::SP + std::to_string(status) + http::SP + reason_phrase + http::CRLF +
+                         headers + http::CRLF;
+
+    // Both loops use the convention of tls::Session: sent bytes, 0 if the socket isn't ready, -1 on error.
+    while (start_sent < response_start.size()) {
+        const char *data = response_start.c_str() + start_sent;
+        size_t size = response_start.size() - start_sent;
+        ssize_t sent_bytes;
+        if (tls_session != nullptr) {
+            sent_bytes = tls_session->write(data, size);
+        } else {
+            // MSG_MORE keeps headers in the socket until the file follows, so that they don't go out
+            // in a separate small segment, which would wait for the client's delayed ACK.
+            sent_bytes = ::send(msg_sock, data, size, MSG_NOSIGNAL | (is_sending_file ? MSG_MORE : 0));
+            if (sent_bytes < 0 && errno == EINTR)
+                continue;
+            if (sent_bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                sent_bytes = 0;
+        }
+        if (sent_bytes == 0)
+            return 0;
+        if (sent_bytes < 0) {
+            std::cout << "Error sending response!" << std::endl;
+            discard();
+            return -1;
+        }
+        start_sent += sent_bytes;
     }
-    bool ret = true;
-    if (is_sending_file) {
-        size_t remaining = file_size;
-        off_t offset = 0;
-        std::cout << "Sending file, file size = " << file_size << std::endl;
-        while (remaining > 0) {
-            ssize_t sent_bytes = sendfile(msg_sock, file_descriptor, (off_t *) &offset, remaining);
-            if (sent_bytes > 0) {
-                remaining -= sent_bytes;
-            } else if (sent_bytes == -1) {
-                std::cout << "Error sending file!" << std::endl;
-                ret = false;
-                break;
-            }
+    if (!is_sending_file)
+        return 1;
+
+    TRACE_STAGE("sendfile");
+    if (file_offset == 0)
+        std::cout << "Sending file" << (tls_session != nullptr ? " over TLS" : "") << ", file size = " << file_size
+                  << std::endl;
+    while ((size_t) file_offset < file_size) {
+        ssize_t sent_bytes;
+        if (tls_session != nullptr) {
+            sent_bytes = tls_session->send_file(file_descriptor, file_offset, file_size - file_offset);
+        } else {
+            off_t offset = file_offset;
+            sent_bytes = sendfile(msg_sock, file_descriptor, &offset, file_size - file_offset);
+            if (sent_bytes == 0) // The file has been truncated in the meantime.
+                sent_bytes = -1;
+            else if (sent_bytes < 0 && errno == EINTR)
+                continue;
+            else if (sent_bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                sent_bytes = 0;
         }
-        close(file_descriptor);
+        if (sent_bytes == 0)
+            return 0;
+        if (sent_bytes < 0) {
+            std::cout << "Error sending file!" << std::endl;
+            discard();
+            return -1;
+        }
+        file_offset += sent_bytes;
     }
-    return ret;
+    discard();
+    return 1;
+}
+
+void Response::discard() {
+    if (is_sending_file)
+        close(file_descriptor);
+    is_sending_file = false;
 }
 
 bool Request::check_header(const http::vs_t &header) {
@@ -16,6 +16,10 @@
 #ifndef ZADANIE_1_HTTP_H
 #define ZADANIE_1_HTTP_H
 
+namespace tls {
+    class Session;
+}
+
 namespace http {
     using vs_t = std::vector<std::string>;
     inline const std::string GET = "GET";
@@ -38,6 +42,7 @@ namespace http {
     inline const std::string NOT_FOUND = "Resource not found!";
     inline const std::string REMOTE_FOUND = "Resource found elsewhere!";
     inline const std::string INVALID_METHOD = "Invalid method!";
+    inline const std::string SERVICE_UNAVAILABLE = "Server is out of resources, try again later!";
 
     // Thrown when client's request has invalid format.
     // Server should response with error 400 when this has been thrown.
@@ -72,9 +77,13 @@ namespace http {
 class Response {
     int status;
     std::string reason_phrase, headers;
-    bool is_sending_file;
+    bool is_sending_file = false;
     int file_descriptor;
     size_t file_size;
+    // State of sending, so that send() can be continued when the socket becomes writable.
+    std::string response_start; // Start line and headers, built by the first send().
+    size_t start_sent = 0;
+    off_t file_offset = 0;
 public:
     Response() = default;
 
@@ -91,10 +100,14 @@ public:
     void set_file_descriptor(int file_descriptor, size_t file_size);
 
     // Sends Response to client.
-    // Sends the start line and headers to msg_sock.
+    // Sends the start line and headers to msg_sock (through 'tls_session', if it isn't nullptr).
     // If file descriptor was set, sends to client content of the file and closes it.
-    // Returns 'true' if Response was sent successfully, 'false' otherwise.
-    bool send(int msg_sock);
+    // 'msg_sock' is non-blocking: returns 1 when the whole response has been sent, 0 if send() has
+    // to be called again when the socket becomes writable and -1 if sending failed.
+    int send(int msg_sock, tls::Session *tls_session = nullptr);
+
+    // Closes the file of a response that won't be sent completely (e.g. the client disconnected).
+    void discard();
 
     [[nodiscard]] int get_status_code() const {
         return status;
@@ -105,6 +118,11 @@ public:
         return response;
     }
 
+    static const Response &create_503_response() {
+        const static Response response(503, http::SERVICE_UNAVAILABLE, http::create_header(http::HEADER_CONTENT_LENGTH, "0"));
+        return response;
+    }
+
     static const Response &create_400_response() {
         const static Response response(400, http::ERROR_400, http::create_header(http::HEADER_CONNECTION, http::CLOSE));
         return response;
@@ -184,7 +202,7 @@ public:
     }
     // Returns 'true' if request has a header with
     // its field name equal to 'field_name' - the parameter.
-    bool is_field_value_set(const std::string &field_name) {
+    [[nodiscard]] bool is_field_value_set(const std::string &field_name) const {
         return headers.find(field_name) != headers.end();
     }
 };
@@ -3,6 +3,8 @@
 //
 
 #include "server.h"
+#include "upgrade.h"
+#include "trace.h"
 #include <stdexcept>
 
 #define MAX_PORT_NUM 65535
@@ -30,6 +32,8 @@ int main(int argc, char **argv) {
             exit_error(INVALID_PORT_NUM);
     }
 
+    upgrade::init(argv);
+    trace::init();
     Server server(FILE_DIR, SERVER_DIR, server_port_num);
     server.run();
 }
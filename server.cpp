@@ -1,6 +1,21 @@
 #include "server.h"
+#include "upgrade.h"
+#include "trace.h"
 
 #include <utility>
+#include <fstream>
+#include <sstream>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+namespace {
+    // Set to 1 by SIGTERM and SIGINT handler.
+    volatile sig_atomic_t stop_requested = 0;
+
+    void handle_stop_signal(int) {
+        stop_requested = 1;
+    }
+}
 
 remote::server_t remote::get_resource(const std::string &res_path, const rservers_t &remote_resources) {
     auto it = remote_resources.find(res_path);
@@ -26,29 +41,6 @@ auto remote::parse_remote_resources(const std::string &server_dir) {
     return remote_resources;
 }
 
-bool file_utils::is_subpath_of(const std::string &canonized_base, const std::string &uncanonized_sub) {
-    std::string canonized_sub;
-    try {
-        canonized_sub = file_utils::canonize(uncanonized_sub);
-    } catch (const file_utils::NoDirException &noDirException) {
-        return false;
-    }
-    auto m = std::mismatch(canonized_base.begin(), canonized_base.end(),
-                           canonized_sub.begin(), canonized_sub.end());
-    return m.first == canonized_base.end();
-}
-
-std::string file_utils::canonize(const std::string &path) {
-    std::string p;
-    try {
-        p = file_utils::fs::canonical(path);
-    } catch (...) {
-        throw file_utils::NoDirException();
-    }
-    return p;
-}
-
-
 bool InputReader::read_request(Request &request, std::istream &input_stream) {
     std::string msg_fragment;
     bool is_eof = false;
@@ -96,33 +88,126 @@ int Server::get_descriptor(const file_utils::fs::path &full_path) {
         is_file_ok = false;
     }
     if (is_file_ok && file_utils::is_subpath_of(base_dir, full_path))
-        file_descriptor = open(full_path.c_str(), O_RDONLY);
+        file_descriptor = open(full_path.c_str(), O_RDONLY | O_CLOEXEC);
 
     return file_descriptor;
 }
 
-Response Server::get_file_response(const Request &request, const remote::rservers_t &remote_resources) {
-    int file_descriptor;
-    Response response;
-    if (!Request::check_req_target(request.get_request_target()))
-        return Response::create_404_response();
+Server::Lookup Server::look_up(const std::string &request_target) {
+    Lookup lookup;
+    file_utils::fs::path full_path = file_utils::fs::path(base_directory + request_target);
+    errno = 0;
+    lookup.file_descriptor = get_descriptor(full_path);
+    if (lookup.file_descriptor == -1 && (errno == EMFILE || errno == ENFILE)) {
+        lookup.is_out_of_descriptors = true;
+    } else if (lookup.file_descriptor != -1) {
+        struct stat file_stat{};
+        if (fstat(lookup.file_descriptor, &file_stat) == 0) {
+            lookup.file_size = file_stat.st_size;
+            // Only to get the beginning into the page cache; the kernel reads ahead the rest.
+            static thread_local char buffer[LOOKUP_READ_SIZE];
+            if (pread(lookup.file_descriptor, buffer, std::min(lookup.file_size, sizeof(buffer)), 0) < 0)
+                std::cerr << "Error reading client resource!" << std::endl;
+        } else {
+            close(lookup.file_descriptor);
+            lookup.file_descriptor = -1;
+        }
+    }
+    return lookup;
+}
+
+Server::Lookup Server::get_cached_lookup(const std::string &request_target) {
+    Lookup lookup;
+    auto it = lookup_cache.find(request_target);
+    // Expired entries are removed by remove_expired_lookups().
+    if (it == lookup_cache.end() || it->second.expiry < std::chrono::steady_clock::now())
+        return lookup;
+    // The cached descriptor is shared, since sendfile() doesn't change the file offset.
+    lookup.file_descriptor = fcntl(it->second.file_descriptor, F_DUPFD_CLOEXEC, 0);
+    struct stat file_stat{};
+    if (lookup.file_descriptor != -1 && fstat(lookup.file_descriptor, &file_stat) == 0) {
+        lookup.file_size = file_stat.st_size;
+    } else if (lookup.file_descriptor != -1) {
+        close(lookup.file_descriptor);
+        lookup.file_descriptor = -1;
+    }
+    return lookup;
+}
 
-    file_utils::fs::path full_path = file_utils::fs::path(base_directory + request.get_request_target());
-    file_descriptor = get_descriptor(full_path);
-    if (file_descriptor != -1) {
-        size_t file_size = file_utils::fs::file_size(full_path);
+void Server::cache_lookup(const std::string &request_target, const Lookup &lookup) {
+    remove_expired_lookups();
+    if (lookup.file_descriptor == -1 || lookup_cache.size() >= lookup_cache_capacity ||
+        lookup_cache.find(request_target) != lookup_cache.end())
+        return;
+    int file_descriptor = fcntl(lookup.file_descriptor, F_DUPFD_CLOEXEC, 0);
+    if (file_descriptor == -1)
+        return;
+    auto expiry = std::chrono::steady_clock::now() + std::chrono::milliseconds(LOOKUP_CACHE_TTL_MS);
+    lookup_cache.insert({request_target, {file_descriptor, expiry}});
+    lookup_cache_order.push_back(request_target);
+}
 
+void Server::remove_expired_lookups() {
+    auto now = std::chrono::steady_clock::now();
+    while (!lookup_cache_order.empty()) {
+        auto it = lookup_cache.find(lookup_cache_order.front());
+        if (it->second.expiry >= now)
+            break;
+        close(it->second.file_descriptor);
+        lookup_cache.erase(it);
+        lookup_cache_order.pop_front();
+    }
+}
+
+int Server::get_timers_timeout() {
+    auto now = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point wake_up = std::chrono::steady_clock::time_point::max();
+    if (!lookup_cache_order.empty())
+        wake_up = lookup_cache.at(lookup_cache_order.front()).expiry;
+    if (accept_paused_until > now)
+        wake_up = std::min(wake_up, accept_paused_until);
+    if (upgrade_channel >= 0)
+        wake_up = std::min(wake_up, upgrade_ack_deadline);
+    for (const auto &[connection_id, connection] : connections) {
+        if (connection.pending_response != nullptr)
+            wake_up = std::min(wake_up, connection.send_deadline);
+    }
+    if (wake_up == std::chrono::steady_clock::time_point::max())
+        return -1;
+    // Rounded up, so that the loop doesn't wake up just before the deadline.
+    return std::max(0L, (long) std::chrono::duration_cast<std::chrono::milliseconds>(wake_up - now).count() + 1);
+}
+
+void Server::close_stalled_connections() {
+    auto now = std::chrono::steady_clock::now();
+    for (auto it = connections.begin(); it != connections.end();) {
+        auto current = it++; // Incremented before the connection is erased.
+        if (current->second.pending_response != nullptr && current->second.send_deadline < now) {
+            std::cerr << "Sending response timed out!" << std::endl;
+            close_connection(current->first);
+        }
+    }
+}
+
+Response Server::get_file_response(const Request &request, const Lookup &lookup) {
+    Response response;
+    if (lookup.is_out_of_descriptors) {
+        std::cerr << "Out of descriptors, client resource can't be opened!" << std::endl;
+        response = Response::create_503_response();
+    } else if (lookup.file_descriptor != -1) {
         response = Response(200, http::ALL_OK);
         response.add_header(http::HEADER_CONTENT_TYPE, http::INPUT_STREAM_TYPE);
-        response.add_header(http::HEADER_CONTENT_LENGTH, std::to_string(file_size));
+        response.add_header(http::HEADER_CONTENT_LENGTH, std::to_string(lookup.file_size));
 
         std::cout << "Client resource found." << std::endl;
+        popularity.record_hit(request.get_request_target(), fs_pool);
         if (request.get_method() == http::GET)
-            response.set_file_descriptor(file_descriptor, file_size);
+            response.set_file_descriptor(lookup.file_descriptor, lookup.file_size);
         else
-            close(file_descriptor);
+            close(lookup.file_descriptor);
     } else {
         try {
+            TRACE_STAGE("remote_lookup");
             remote::server_t res = remote::get_resource(request.get_request_target(), remote_resources);
             std::cout << "Client resource found in remote servers." << std::endl;
             response = Response(302, http::REMOTE_FOUND, http::create_header("Location",
@@ -146,63 +231,349 @@ Server::Server(const std::string &base_dir_arg, std::string server_path_arg, uin
         exit_error("Problems with base directory!");
     }
 
+    tls_context.init_from_env();
+
+    struct rlimit nofile{};
+    if (getrlimit(RLIMIT_NOFILE, &nofile) == 0 && nofile.rlim_cur != RLIM_INFINITY)
+        lookup_cache_capacity = std::min((rlim_t) LOOKUP_CACHE_SIZE, nofile.rlim_cur / LOOKUP_CACHE_NOFILE_SHARE);
+
+    const char *warmup_list = getenv(WARMUP_LIST_ENV);
+    if (warmup_list != nullptr) {
+        popularity = warmup::Popularity(warmup_list);
+        warmer.start(base_directory, popularity.get_hottest());
+    }
+
     // after socket() call; we should CLOSE(sock) on any execution path;
     // since all execution paths exit immediately, sock would be closed when program terminates
     server_address.sin_family = AF_INET; // IPv4
     server_address.sin_addr.s_addr = htonl(INADDR_ANY); // listening on all interfaces
     server_address.sin_port = htons(port_num); // listening on port PORT_NUM
 
-    create_socket();
-    bind_socket();
-    switch_to_listen();
+    sock = upgrade::receive_listening_socket();
+    if (sock < 0) {
+        create_socket();
+        bind_socket();
+        switch_to_listen();
+    }
 }
 
-void Server::run() {
-    remote::rservers_t remote_resources = remote::parse_remote_resources(remote_servers_path);
-    struct sockaddr_in client_address;
+void Server::check_upgrade() {
+    if (upgrade_channel >= 0 && upgrade_ack_deadline < std::chrono::steady_clock::now()) {
+        upgrade::abort_hand_off();
+        upgrade_channel = -1;
+    }
+    // Another upgrade requested in the meantime is started after the current one fails.
+    if (!upgrade::requested || upgraded || upgrade_channel >= 0)
+        return;
+    upgrade::requested = 0;
+    std::cout << "Upgrading server!" << std::endl;
+    popularity.save(); // So that the new process warms resources popular so far.
+    upgrade_channel = upgrade::start_hand_off(sock);
+    upgrade_ack_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(UPGRADE_ACK_TIMEOUT_MS);
+}
+
+void Server::finish_upgrade() {
+    upgrade_channel = -1;
+    if (!upgrade::finish_hand_off())
+        return;
+    std::cout << "New server is ready, draining connections!" << std::endl;
+    if (close(sock) < 0)
+        exit_error("Error closing listening socket!");
+    upgraded = true;
+    popularity.hand_over();
+    drain_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(DRAIN_TIMEOUT_MS);
+}
+
+void Server::accept_client() {
+    struct sockaddr_in client_address{};
     socklen_t client_address_len = sizeof(client_address);
-    signal(SIGPIPE, SIG_IGN);
+    // Client sockets mustn't be inherited by the process started by an upgrade.
+    // Sockets are non-blocking, so that a slow client can't stall the event loop.
+    int msg_sock = accept4(sock, (struct sockaddr *) &client_address, &client_address_len,
+                           SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (msg_sock < 0) {
+        if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+            // The pending client stays in the backlog and would make poll() return immediately again.
+            std::cerr << "Out of resources, pausing accepting clients!" << std::endl;
+            accept_paused_until = std::chrono::steady_clock::now() + std::chrono::milliseconds(ACCEPT_PAUSE_MS);
+        } else if (errno != EAGAIN && errno != ECONNABORTED && errno != EINTR) {
+            std::cerr << "accept error" << std::endl;
+        }
+        return;
+    }
+    std::cout << "Connected to new client: " << msg_sock << std::endl;
+    Connection connection;
+    connection.sock = msg_sock;
+    if (tls_context.is_enabled()) {
+        connection.tls_session = tls_context.new_session(msg_sock);
+        if (connection.tls_session == nullptr) {
+            std::cerr << "Creating TLS session failed!" << std::endl;
+            close(msg_sock);
+            return;
+        }
+    }
+    connections.insert({next_connection_id++, std::move(connection)});
+}
+
+void Server::read_from(uint64_t connection_id) {
+    Connection &connection = connections.at(connection_id);
+    if (connection.tls_session != nullptr) {
+        if (!connection.tls_session->is_handshake_done()) {
+            int handshake_result;
+            {
+                TRACE_STAGE("tls_handshake");
+                handshake_result = connection.tls_session->handshake();
+            }
+            if (handshake_result < 0)
+                close_connection(connection_id);
+            if (handshake_result <= 0)
+                return;
+        }
+        if (!connection.tls_session->read(connection.input)) {
+            close_connection(connection_id);
+            return;
+        }
+        handle_input(connection_id);
+        return;
+    }
+
+    char buffer[READ_BUFFER_SIZE];
+    ssize_t read_bytes = read(connection.sock, buffer, sizeof(buffer));
+    if (read_bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return;
+    if (read_bytes <= 0) {
+        if (read_bytes < 0)
+            std::cerr << "Error reading from client!" << std::endl;
+        close_connection(connection_id);
+        return;
+    }
+    connection.input.append(buffer, read_bytes);
+    handle_input(connection_id);
+}
+
+void Server::handle_input(uint64_t connection_id) {
     for (;;) {
-        std::cout << "Accepting new clients!" << std::endl;
-        int msg_sock = accept(sock, (struct sockaddr *) &client_address, &client_address_len);
-        std::cout << "Connected to new client: " << msg_sock << std::endl;
+        auto it = connections.find(connection_id);
+        if (it == connections.end() || it->second.is_waiting_for_lookup || it->second.pending_response != nullptr)
+            return;
+        Connection &connection = it->second;
 
-        __gnu_cxx::stdio_filebuf<char> filebuf(msg_sock, std::ios::in);
-        std::istream input_stream(&filebuf);
+        // Request ends with an empty line.
+        size_t line_start = connection.scanned, request_end = std::string::npos;
+        while (line_start < connection.input.size()) {
+            if (connection.input.compare(line_start, http::CRLF.size(), http::CRLF) == 0) {
+                request_end = line_start + http::CRLF.size();
+                break;
+            }
+            size_t line_end = connection.input.find('\n', line_start);
+            if (line_end == std::string::npos)
+                break;
+            line_start = line_end + 1;
+        }
+        if ((request_end == std::string::npos ? connection.input.size() : request_end) > MAX_REQUEST_HEAD_SIZE) {
+            std::cout << "Client request is too long!" << std::endl;
+            Response response = Response::create_400_response();
+            respond(connection_id, response, true);
+            return;
+        }
+        if (request_end == std::string::npos) {
+            connection.scanned = line_start;
+            return;
+        }
+        std::istringstream input_stream(connection.input.substr(0, request_end));
+        connection.input.erase(0, request_end);
+        connection.scanned = 0;
 
+        Request request;
         InputReader inputReader;
+        bool is_request_ok;
+        {
+            TRACE_STAGE("read_request");
+            is_request_ok = inputReader.read_request(request, input_stream);
+        }
+        std::cout << "Client request read!" << std::endl;
+        if (!is_request_ok) {
+            Response response = inputReader.get_error_response();
+            std::cout << "Client request wasn't valid! " << response.get_status_code() << std::endl;
+            respond(connection_id, response, true);
+            return;
+        }
 
-        bool is_connection = true;
-        while (is_connection) {
-            Request request;
-            Response response;
-            is_connection = inputReader.read_request(request, input_stream);
-            std::cout << "Client request read!" << std::endl;
-            if (!is_connection) {
-                response = inputReader.get_error_response();
-                std::cout << "Client request wasn't valid! " << response.get_status_code() << std::endl;
-            } else {
-                std::cout << "Searching for client resource!" << std::endl;
-                response = get_file_response(request, remote_resources);
-                if (request.is_field_value_set(http::HEADER_CONNECTION) &&
-                    request.get_field_value(http::HEADER_CONNECTION) == http::CLOSE) {
-                    response.add_header(http::HEADER_CONNECTION, http::CLOSE);
-                    is_connection = false;
-                }
-            }
-            std::cout << "Sending response!" << std::endl;
-            if (!response.send(msg_sock)) {
-                std::cerr << "Client most likely disconnected." << std::endl;
-                is_connection = false;
-            }
+        std::cout << "Searching for client resource!" << std::endl;
+        const std::string &request_target = request.get_request_target();
+        if (!Request::check_req_target(request_target)) {
+            if (!respond_to(connection_id, request, Response::create_404_response()))
+                return;
+            continue;
+        }
+        Lookup lookup = get_cached_lookup(request_target);
+        if (lookup.file_descriptor != -1) {
+            if (!respond_with_file(connection_id, request, lookup))
+                return;
+            continue;
+        }
 
-            if (!is_connection) {
-                std::cout << "Closing client connection!" << std::endl;
-                if (close(msg_sock) < 0)
-                    exit_error("Error closing connection!");
+        connection.is_waiting_for_lookup = true;
+        auto result = std::make_shared<Lookup>();
+        fs_pool.submit([this, result, request_target] {
+            *result = look_up(request_target);
+        }, [this, result, request, connection_id] {
+            auto it = connections.find(connection_id);
+            if (it == connections.end()) { // Closed when the drain deadline passed.
+                if (result->file_descriptor != -1)
+                    close(result->file_descriptor);
+                return;
             }
+            it->second.is_waiting_for_lookup = false;
+            cache_lookup(request.get_request_target(), *result);
+            if (respond_with_file(connection_id, request, *result))
+                handle_input(connection_id);
+        });
+    }
+}
+
+bool Server::respond(uint64_t connection_id, Response &response, bool is_closing) {
+    std::cout << "Sending response!" << std::endl;
+    Connection &connection = connections.at(connection_id);
+    int send_result = response.send(connection.sock, connection.tls_session.get());
+    if (send_result == 0) {
+        connection.pending_response = std::make_unique<Response>(std::move(response));
+        connection.is_closing_after_response = is_closing;
+        connection.send_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(SEND_TIMEOUT_MS);
+        return true;
+    }
+    if (send_result < 0) {
+        std::cerr << "Client most likely disconnected." << std::endl;
+        is_closing = true;
+    }
+    if (is_closing)
+        close_connection(connection_id);
+    return !is_closing;
+}
+
+void Server::write_to(uint64_t connection_id) {
+    Connection &connection = connections.at(connection_id);
+    int send_result = connection.pending_response->send(connection.sock, connection.tls_session.get());
+    if (send_result == 0) {
+        connection.send_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(SEND_TIMEOUT_MS);
+        return;
+    }
+    connection.pending_response.reset();
+    if (send_result < 0)
+        std::cerr << "Client most likely disconnected." << std::endl;
+    if (send_result < 0 || connection.is_closing_after_response) {
+        close_connection(connection_id);
+        return;
+    }
+    handle_input(connection_id);
+}
+
+bool Server::respond_with_file(uint64_t connection_id, const Request &request, const Lookup &lookup) {
+    return respond_to(connection_id, request, get_file_response(request, lookup));
+}
+
+bool Server::respond_to(uint64_t connection_id, const Request &request, Response response) {
+    bool is_closing = false;
+    if (request.is_field_value_set(http::HEADER_CONNECTION) &&
+        request.get_field_value(http::HEADER_CONNECTION) == http::CLOSE) {
+        is_closing = true;
+    } else if (upgraded) {
+        // Makes the client reconnect to the new process.
+        is_closing = true;
+    }
+    if (is_closing)
+        response.add_header(http::HEADER_CONNECTION, http::CLOSE);
+    return respond(connection_id, response, is_closing);
+}
+
+void Server::close_connection(uint64_t connection_id) {
+    auto it = connections.find(connection_id);
+    std::cout << "Closing client connection!" << std::endl;
+    if (it->second.pending_response != nullptr)
+        it->second.pending_response->discard();
+    it->second.tls_session.reset(); // Sends close_notify, so it has to be done before closing the socket.
+    if (close(it->second.sock) < 0)
+        exit_error("Error closing connection!");
+    connections.erase(it);
+}
+
+void Server::run() {
+    remote_resources = remote::parse_remote_resources(remote_servers_path);
+    signal(SIGPIPE, SIG_IGN);
+    struct sigaction action{};
+    action.sa_handler = handle_stop_signal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = 0; // No SA_RESTART, so that waiting for clients is interrupted.
+    if (sigaction(SIGTERM, &action, nullptr) < 0 || sigaction(SIGINT, &action, nullptr) < 0)
+        exit_error("sigaction error");
+    upgrade::confirm_ready();
+    std::vector<struct pollfd> poll_fds;
+    std::vector<uint64_t> polled_connections; // Ids of connections in poll_fds, after the fixed descriptors.
+    while (!stop_requested) {
+        check_upgrade();
+        trace::check_dump();
+        remove_expired_lookups();
+        close_stalled_connections();
+        int timeout = get_timers_timeout();
+        if (upgraded) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    drain_deadline - std::chrono::steady_clock::now());
+            if (connections.empty() || remaining.count() <= 0)
+                break;
+            timeout = timeout < 0 ? remaining.count() : std::min(timeout, (int) remaining.count());
+        }
+
+        poll_fds.clear();
+        polled_connections.clear();
+        poll_fds.push_back({fs_pool.get_event_fd(), POLLIN, 0});
+        // After the upgrade the listening socket is closed, so -1 makes poll() ignore it.
+        bool is_accepting = !upgraded && accept_paused_until <= std::chrono::steady_clock::now();
+        poll_fds.push_back({is_accepting ? sock : -1, POLLIN, 0});
+        poll_fds.push_back({upgrade_channel, POLLIN, 0});
+        for (const auto &[connection_id, connection] : connections) {
+            if (connection.is_waiting_for_lookup)
+                continue;
+            short events = POLLIN;
+            if (connection.tls_session != nullptr)
+                events = connection.tls_session->get_poll_events();
+            else if (connection.pending_response != nullptr)
+                events = POLLOUT;
+            poll_fds.push_back({connection.sock, events, 0});
+            polled_connections.push_back(connection_id);
+        }
+
+        if (poll(poll_fds.data(), poll_fds.size(), timeout) < 0) {
+            if (errno == EINTR)
+                continue; // Interrupted by a signal, maybe upgrade or stop was requested.
+            exit_error("poll error");
+        }
+        if (poll_fds[0].revents & POLLIN)
+            fs_pool.run_completions();
+        if (poll_fds[1].revents & POLLIN)
+            accept_client();
+        if (poll_fds[2].revents != 0)
+            finish_upgrade();
+        for (size_t i = 0; i < polled_connections.size(); i++) {
+            // Connection could have been closed already, if it was served by a completion.
+            auto it = connections.find(polled_connections[i]);
+            if (poll_fds[i + 3].revents == 0 || it == connections.end())
+                continue;
+            if (it->second.pending_response != nullptr)
+                write_to(it->first);
+            else
+                read_from(it->first);
         }
     }
+
+    if (stop_requested)
+        std::cout << "Stopping the server!" << std::endl;
+    else if (!connections.empty())
+        std::cout << "Drain deadline passed, closing client connections!" << std::endl;
+    while (!connections.empty())
+        close_connection(connections.begin()->first);
+    // Hits since the last save would be lost otherwise. Does nothing after an upgrade,
+    // the new process owns the list then.
+    popularity.save();
 }
 
 void exit_error(const std::string &message) {
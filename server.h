@@ -13,15 +13,35 @@
 #include <unistd.h>
 #include <iostream>
 #include <string>
-#include <ext/stdio_filebuf.h>
 #include <fcntl.h>
 #include <csignal>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <poll.h>
 #include "http.h"
+#include "warmup.h"
+#include "fs_pool.h"
+#include "tls.h"
+#include "common.h"
+#include "file_utils.h"
 
 #define QUEUE_LENGTH 5
-
-// Prints message to stderr and exits program with code EXIT_FAILURE.
-void exit_error(const std::string &message);
+// How long descriptors of found files are kept in the lookup cache.
+#define LOOKUP_CACHE_TTL_MS 1000
+// Upper bound on the number of descriptors in the lookup cache. The cache takes at most
+// 1/LOOKUP_CACHE_NOFILE_SHARE of RLIMIT_NOFILE, so that clients and sent files have descriptors left.
+#define LOOKUP_CACHE_SIZE 1024
+#define LOOKUP_CACHE_NOFILE_SHARE 4
+// For how long accepting clients is paused when the process runs out of descriptors.
+#define ACCEPT_PAUSE_MS 100
+// Connections whose client doesn't take any part of a response for this long are closed.
+#define SEND_TIMEOUT_MS 10000
+// Number of bytes of a file read when it is looked up in fs_pool, so that sending its beginning
+// from the event loop doesn't wait for the disk.
+#define LOOKUP_READ_SIZE (64 * 1024)
+// Requests whose request line and headers are longer than this are answered with 400 and the connection is closed.
+#define MAX_REQUEST_HEAD_SIZE (8 * 1024)
 
 // Contains some useful definitions and methods that can be used when dealing
 // with remote servers.
@@ -43,26 +63,6 @@ namespace remote {
     auto parse_remote_resources(const std::string &server_dir);
 }
 
-namespace file_utils {
-    namespace fs = std::experimental::filesystem;
-
-    // Returns string containing canonized path.
-    // Does it using filesystem::canonize() method.
-    // Throws NoDirException if canonizing failed (path doesn't exist).
-    std::string canonize(const std::string &path);
-
-    // Returns 'true' if directory uncanonized_sub is contained in the 'canonized_base'.
-    // As the parameter name suggest, canonized_base should contain canonicalized version of path.
-    bool is_subpath_of(const std::string &canonized_base, const std::string &uncanonized_sub);
-
-    class NoDirException : public std::exception {
-    public:
-        [[nodiscard]] const char *what() const noexcept override {
-            return "Directory not found!";
-        }
-    };
-}
-
 class InputReader {
     // When read_request() failed for some reason, this flag is set to the appropriate response.
     Response errorResponse;
@@ -83,12 +83,75 @@ public:
 };
 
 class Server {
+    // Client connection served by the event loop in run().
+    struct Connection {
+        int sock;
+        std::string input; // Bytes received from the client that haven't been handled yet.
+        // Start of the first line of input that hasn't been checked for the end of the request yet.
+        size_t scanned = 0;
+        // Set while the file requested by the client is looked up in fs_pool.
+        // Input of the connection isn't handled until then, so that responses are sent in order.
+        bool is_waiting_for_lookup = false;
+        // TLS session with the client, nullptr if the server doesn't use TLS.
+        std::unique_ptr<tls::Session> tls_session;
+        // Response that couldn't be sent at once; sending continues when the socket becomes writable.
+        // Like during a lookup, input isn't handled until then.
+        std::unique_ptr<Response> pending_response;
+        bool is_closing_after_response = false;
+        // The connection is closed if sending the pending response makes no progress until then.
+        std::chrono::steady_clock::time_point send_deadline;
+    };
+
+    // Result of looking up the requested file.
+    struct Lookup {
+        int file_descriptor = -1; // -1 if the file wasn't found.
+        size_t file_size = 0;
+        // Set if the file couldn't be opened because the process or the system ran out of descriptors.
+        bool is_out_of_descriptors = false;
+    };
+
+    // Descriptor of a file that has been found recently, so that requests for it
+    // can be answered without touching the filesystem.
+    struct CachedLookup {
+        int file_descriptor;
+        std::chrono::steady_clock::time_point expiry;
+    };
+
     struct sockaddr_in server_address{};
     int sock{};
     std::string base_directory, remote_servers_path;
+    remote::rservers_t remote_resources;
+    // Set when the listening socket has been handed off to a new process.
+    bool upgraded = false;
+    // While a new process started by an upgrade is getting ready, its confirmation comes through this descriptor
+    // (-1 otherwise) until 'upgrade_ack_deadline'.
+    int upgrade_channel = -1;
+    std::chrono::steady_clock::time_point upgrade_ack_deadline;
+    // After the upgrade, open connections are closed when this deadline passes.
+    std::chrono::steady_clock::time_point drain_deadline;
+    // Popularity of resources, used to warm the most popular ones first after a restart.
+    warmup::Popularity popularity;
+    // Warms the page cache in background, if enabled with WARMUP_LIST_ENV.
+    warmup::Warmer warmer;
+    // Maps connection ids to connections. Ids (unlike sockets) are never reused,
+    // so completions of lookups can tell whether their connection has been closed in the meantime.
+    std::map<uint64_t, Connection> connections;
+    uint64_t next_connection_id = 0;
+    // Maps request targets to descriptors of the files they represent.
+    std::map<std::string, CachedLookup> lookup_cache;
+    // Keys of 'lookup_cache' from the oldest. All entries live for LOOKUP_CACHE_TTL_MS,
+    // so this is also the order in which they expire.
+    std::deque<std::string> lookup_cache_order;
+    size_t lookup_cache_capacity = LOOKUP_CACHE_SIZE;
+    // While accepting is paused (after running out of descriptors), the listening socket isn't polled.
+    std::chrono::steady_clock::time_point accept_paused_until;
+    // Does filesystem work that may block, so that it doesn't stall other connections.
+    FsPool fs_pool;
+    // Enabled with TLS_CERT_ENV and TLS_KEY_ENV.
+    tls::Context tls_context;
 
     void create_socket() {
-        sock = socket(PF_INET, SOCK_STREAM, 0); // creating IPv4 TCP socket
+        sock = socket(PF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0); // creating IPv4 TCP socket
         if (sock < 0)
             exit_error("socket error");
     }
@@ -103,22 +166,89 @@ class Server {
             exit_error("listen");
     }
 
+    // If upgrade was requested, starts a new process and hands the listening socket off to it.
+    // Gives up if the new process doesn't confirm it is ready until 'upgrade_ack_deadline'.
+    void check_upgrade();
+
+    // Handles the confirmation of the new process, after 'upgrade_channel' became readable.
+    // When the new process took over, closes the listening socket and starts draining.
+    void finish_upgrade();
+
+    // Accepts new client and adds it to 'connections'.
+    void accept_client();
+
+    // Reads available bytes from the connection (after finishing TLS handshake, if there is one)
+    // and handles requests that have been received completely.
+    void read_from(uint64_t connection_id);
+
+    // Continues sending the pending response of the connection. When it has been sent, closes the connection
+    // or handles the rest of its input.
+    void write_to(uint64_t connection_id);
+
+    // Handles requests from the input of the connection, until the input contains no complete request
+    // or the connection starts waiting for a lookup or for the socket to send a response.
+    // Closes the connection if it should be closed.
+    void handle_input(uint64_t connection_id);
+
+    // Sends 'response' to the client. Closes the connection if 'is_closing' is set or sending failed.
+    // If the response can't be sent at once, it becomes pending and the connection is closed (if 'is_closing')
+    // after it has been sent.
+    // Returns 'true' if the connection is still open.
+    bool respond(uint64_t connection_id, Response &response, bool is_closing);
+
+    // Sends 'response' to correct 'request'. Adds "Connection: close" header and closes the connection
+    // if the client asked for it or the server is draining connections after an upgrade.
+    // Returns 'true' if the connection is still open.
+    bool respond_to(uint64_t connection_id, const Request &request, Response response);
+
+    // Responds to correct 'request' using 'lookup' of its target, see respond_to().
+    // Returns 'true' if the connection is still open.
+    bool respond_with_file(uint64_t connection_id, const Request &request, const Lookup &lookup);
+
+    void close_connection(uint64_t connection_id);
+
+    // Returns lookup of 'request_target' from 'lookup_cache' (with a new descriptor of the file).
+    // Returns Lookup with file_descriptor equal to -1 if there's no valid entry in the cache.
+    Lookup get_cached_lookup(const std::string &request_target);
+
+    // Adds successful 'lookup' of 'request_target' to 'lookup_cache' (after removing expired entries).
+    void cache_lookup(const std::string &request_target, const Lookup &lookup);
+
+    // Closes descriptors of expired 'lookup_cache' entries and removes them.
+    void remove_expired_lookups();
+
+    // Returns poll() timeout (in milliseconds, -1 for none) after which the event loop has to wake up
+    // to expire cached lookups, resume accepting clients or close connections whose sending stalled.
+    int get_timers_timeout();
+
+    // Closes connections whose pending response has made no progress until their 'send_deadline'.
+    void close_stalled_connections();
+
+    // Looks the file represented by 'request_target' up in the base directory and reads its beginning
+    // (up to LOOKUP_READ_SIZE bytes) into the page cache. May block, so it's run in fs_pool.
+    Lookup look_up(const std::string &request_target);
+
     // Uses open() to get descriptor of the file represented by 'full_path'.
     // If open succeeded, returns file descriptor. Otherwise returns -1.
     int get_descriptor(const file_utils::fs::path &full_path);
 
-    // Takes correct request and creates a response based on it.
-    // Can return response with code 200, 302 or 404.
+    // Takes correct request and the lookup of its target and creates a response based on them.
+    // Can return response with code 200, 302, 404 or 503 (if the server ran out of descriptors).
     // Doesn't check if "Connection: close" header appears in the request, so the response won't contain
     // this header either.
-    Response get_file_response(const Request &request, const remote::rservers_t &remote_resources);
+    Response get_file_response(const Request &request, const Lookup &lookup);
 
 public:
     // Initializes the server by on port_num by creating socket, binding and switching to listen.
+    // If the process was started by an upgrade, uses listening socket of the old process instead.
+    // If WARMUP_LIST_ENV is set, starts warming the page cache with files from the base directory.
+    // If TLS_CERT_ENV and TLS_KEY_ENV are set, loads the certificate and serves clients over TLS.
     // Updates other class fields.
     Server(const std::string &base_dir_arg, std::string server_path_arg, uint32_t port_num);
 
-    // Runs the server in endless loop.
+    // Runs the server in endless loop, serving all connections with poll().
+    // Returns after the listening socket has been handed off to a new process
+    // and the open connections have been drained.
     void run();
 };
 
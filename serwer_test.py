@@ -0,0 +1,232 @@
+#
+# Helpers shared by the test and benchmark scripts: building and starting serwer,
+# preparing the directory with files and generating load.
+#
+
+import atexit
+import http.client
+import os
+import resource
+import shutil
+import signal
+import socket
+import ssl
+import subprocess
+import tempfile
+import threading
+import time
+
+REPO_DIR = os.path.dirname(os.path.abspath(__file__))
+
+
+def build(make_args=(), binary_name="serwer"):
+    """Builds serwer with 'make_args' and copies the binary out of the tree.
+    Returns path to the copy, so that builds with different flags can be compared."""
+    subprocess.run(["make", "-C", REPO_DIR, "clean"], check=True, stdout=subprocess.DEVNULL)
+    subprocess.run(["make", "-C", REPO_DIR, "-j4"] + list(make_args), check=True, stdout=subprocess.DEVNULL)
+    out_dir = tempfile.mkdtemp(prefix="serwer-bin-")
+    atexit.register(shutil.rmtree, out_dir, ignore_errors=True)
+    binary = os.path.join(out_dir, binary_name)
+    shutil.copy(os.path.join(REPO_DIR, "serwer"), binary)
+    subprocess.run(["make", "-C", REPO_DIR, "clean"], check=True, stdout=subprocess.DEVNULL)
+    return binary
+
+
+def build_slow_fs_shim():
+    """Builds bench-slow-fs.c, the LD_PRELOAD library delaying open() of paths containing "/slow/"
+    by SLOW_OPEN_MS (environment variable). Returns path to the library."""
+    out_dir = tempfile.mkdtemp(prefix="serwer-shim-")
+    atexit.register(shutil.rmtree, out_dir, ignore_errors=True)
+    shim = os.path.join(out_dir, "bench-slow-fs.so")
+    subprocess.run(["cc", "-shared", "-fPIC", "-o", shim, os.path.join(REPO_DIR, "bench-slow-fs.c"), "-ldl"],
+                   check=True)
+    return shim
+
+
+def free_port():
+    with socket.socket() as s:
+        s.bind(("127.0.0.1", 0))
+        return s.getsockname()[1]
+
+
+def make_files(sizes):
+    """Creates a temporary base directory with files 'name' -> size in bytes
+    and an empty file with correlated servers. Returns (base directory, servers file)."""
+    work_dir = tempfile.mkdtemp(prefix="serwer-test-")
+    atexit.register(shutil.rmtree, work_dir, ignore_errors=True)
+    base_dir = os.path.join(work_dir, "files")
+    os.mkdir(base_dir)
+    for name, size in sizes.items():
+        path = os.path.join(base_dir, name.lstrip("/"))
+        os.makedirs(os.path.dirname(path), exist_ok=True)
+        with open(path, "wb") as f:
+            f.write(os.urandom(size))
+    servers_file = os.path.join(work_dir, "servers.txt")
+    open(servers_file, "w").close()
+    return base_dir, servers_file
+
+
+class Server:
+    """Running serwer process; its output goes to 'log_path'. 'nofile' limits its number of descriptors."""
+
+    def __init__(self, binary, base_dir, servers_file, port=None, env=None, preload=None, nofile=None):
+        self.port = port or free_port()
+        self.log_path = os.path.join(os.path.dirname(base_dir), "serwer-%d.log" % self.port)
+        full_env = dict(os.environ)
+        full_env.update(env or {})
+        if preload:
+            full_env["LD_PRELOAD"] = preload
+        self.log = open(self.log_path, "w")
+        self.args = [binary, base_dir, servers_file, str(self.port)]
+        def set_limits():
+            if nofile:
+                resource.setrlimit(resource.RLIMIT_NOFILE, (nofile, nofile))
+        self.process = subprocess.Popen(self.args, stdout=self.log, stderr=subprocess.STDOUT, env=full_env,
+                                        preexec_fn=set_limits)
+        self.pid = self.process.pid
+        # So that a failing script doesn't leave servers behind.
+        atexit.register(self.kill)
+        wait_for_port(self.port)
+
+    def find_pids(self):
+        """Returns pids of all running serwer processes started with this server's arguments
+        (hot upgrades start new ones)."""
+        pids = []
+        for entry in os.listdir("/proc"):
+            if not entry.isdigit():
+                continue
+            try:
+                with open("/proc/%s/cmdline" % entry, "rb") as f:
+                    cmdline = f.read().split(b"\0")[:-1]
+            except OSError:
+                continue
+            if [arg.decode(errors="replace") for arg in cmdline] == self.args and is_alive(int(entry)):
+                pids.append(int(entry))
+        return pids
+
+    def read_log(self):
+        with open(self.log_path, errors="replace") as f:
+            return f.read()
+
+    def kill(self):
+        for pid in [self.pid] + self.find_pids():
+            try:
+                os.kill(pid, signal.SIGKILL)
+            except ProcessLookupError:
+                pass
+        self.process.wait()
+
+    def stop(self, pids=()):
+        for pid in [self.pid] + list(pids):
+            try:
+                os.kill(pid, signal.SIGTERM)
+            except ProcessLookupError:
+                pass
+        self.process.wait()
+        self.log.close()
+
+
+def wait_for_port(port, timeout=5.0):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        try:
+            socket.create_connection(("127.0.0.1", port), timeout=0.2).close()
+            return
+        except OSError:
+            time.sleep(0.02)
+    raise RuntimeError("serwer didn't start listening on port %d" % port)
+
+
+def is_alive(pid):
+    try:
+        os.kill(pid, 0)
+    except ProcessLookupError:
+        return False
+    # Zombies (exited children not reaped yet) count as dead.
+    with open("/proc/%d/stat" % pid) as f:
+        return f.read().split(")")[-1].split()[0] != "Z"
+
+
+def percentile(values, p):
+    if not values:
+        return float("nan")
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100))]
+
+
+class Load:
+    """Clients requesting 'paths' in a loop until stop() is called.
+    Half of them (or all, with keep_alive=True) reuse their connections."""
+
+    def __init__(self, port, paths, clients=4, keep_alive=None, tls_context=None, expected_sizes=None):
+        self.port, self.paths, self.tls_context = port, paths, tls_context
+        self.expected_sizes = expected_sizes or {}
+        self.ok = self.failed = 0
+        self.latencies = []  # (finish time, latency) pairs
+        self.errors = []
+        self.lock = threading.Lock()
+        self.stopped = threading.Event()
+        self.threads = [threading.Thread(target=self._client, args=(i, keep_alive if keep_alive is not None
+                                                                      else i % 2 == 0),
+                                         daemon=True)
+                        for i in range(clients)]
+
+    def _connect(self):
+        if self.tls_context:
+            return http.client.HTTPSConnection("localhost", self.port, context=self.tls_context, timeout=10)
+        return http.client.HTTPConnection("127.0.0.1", self.port, timeout=10)
+
+    def _client(self, index, keep_alive):
+        connection = None
+        request_index = index
+        while not self.stopped.is_set():
+            path = self.paths[request_index % len(self.paths)]
+            request_index += 1
+            start = time.time()
+            try:
+                if connection is None:
+                    connection = self._connect()
+                connection.request("GET", path)
+                response = connection.getresponse()
+                body = response.read()
+                expected_size = self.expected_sizes.get(path)
+                is_ok = response.status == 200 and (expected_size is None or len(body) == expected_size)
+                if not keep_alive or response.getheader("Connection") == "close":
+                    connection.close()
+                    connection = None
+            except Exception as e:
+                is_ok = False
+                with self.lock:
+                    self.errors.append(repr(e))
+                connection = None
+            end = time.time()
+            with self.lock:
+                if is_ok:
+                    self.ok += 1
+                    self.latencies.append((end, end - start))
+                else:
+                    self.failed += 1
+
+    def start(self):
+        for thread in self.threads:
+            thread.start()
+        return self
+
+    def stop(self):
+        self.stopped.set()
+        for thread in self.threads:
+            thread.join()
+
+
+def make_certificate(work_dir):
+    """Generates a self-signed certificate for localhost in 'work_dir'. Returns (certificate path, key path)."""
+    cert, key = os.path.join(work_dir, "cert.pem"), os.path.join(work_dir, "key.pem")
+    subprocess.run(["openssl", "req", "-x509", "-newkey", "ec", "-pkeyopt", "ec_paramgen_curve:prime256v1",
+                    "-nodes", "-keyout", key, "-out", cert, "-days", "1", "-subj", "/CN=localhost",
+                    "-addext", "subjectAltName=DNS:localhost,IP:127.0.0.1"],
+                   check=True, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    return cert, key
+
+
+def tls_env(cert, key):
+    return {"SERWER_TLS_CERT": cert, "SERWER_TLS_KEY": key}
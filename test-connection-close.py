@@ -0,0 +1,71 @@
+#!/usr/bin/env python3
+#
+# Checks that the server closes the connection after answering a request with "Connection: close",
+# for found files as well as for request targets that are invalid or don't exist, and that a request
+# whose headers never end is answered with 400 and closed instead of being buffered without limit.
+# Usage: ./test-connection-close.py [<path-to-serwer>]
+#
+
+import socket
+import sys
+
+import serwer_test
+
+FILE_SIZES = {"/file": 100}
+TARGETS = ["/file", "/missing", "/../file", "/invalid_characters~"]
+# More than MAX_REQUEST_HEAD_SIZE of headers, sent in pieces without the empty line that ends the request.
+LONG_HEADER = b"X-Padding: " + b"a" * 1000 + b"\r\n"
+LONG_HEADERS_COUNT = 20
+
+
+def is_closed_after(port, target):
+    """Sends a request with "Connection: close" and returns whether the server closed the connection."""
+    with socket.create_connection(("127.0.0.1", port), timeout=2) as sock:
+        sock.sendall(("GET %s HTTP/1.1\r\nConnection: close\r\n\r\n" % target).encode())
+        try:
+            while sock.recv(4096):
+                pass
+        except socket.timeout:
+            return False
+    return True
+
+
+def is_long_head_rejected(port):
+    """Sends headers that never end and returns whether the server answered 400 and closed the connection."""
+    with socket.create_connection(("127.0.0.1", port), timeout=2) as sock:
+        try:
+            sock.sendall(b"GET /file HTTP/1.1\r\n")
+            for _ in range(LONG_HEADERS_COUNT):
+                sock.sendall(LONG_HEADER)
+        except ConnectionError:  # The server closed the connection while headers were still being sent.
+            pass
+        response = b""
+        try:
+            while True:
+                data = sock.recv(4096)
+                if not data:
+                    break
+                response += data
+        except socket.timeout:
+            return False
+        except ConnectionError:
+            pass
+    return response.startswith(b"HTTP/1.1 400")
+
+
+def main():
+    binary = sys.argv[1] if len(sys.argv) > 1 else serwer_test.build()
+    base_dir, servers_file = serwer_test.make_files(FILE_SIZES)
+    server = serwer_test.Server(binary, base_dir, servers_file)
+    open_targets = [target for target in TARGETS if not is_closed_after(server.port, target)]
+    is_rejected = is_long_head_rejected(server.port)
+    server.stop()
+    if open_targets:
+        sys.exit("FAIL: connection left open after requests for %s" % open_targets)
+    if not is_rejected:
+        sys.exit("FAIL: request with too long headers wasn't answered with 400 and closed")
+    print("PASS")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,116 @@
+#!/usr/bin/env python3
+#
+# Runs the server with a low limit of descriptors and checks that running out of them
+# pauses accepting clients instead of spinning, that existing files are answered with 503 rather than 404
+# and that the lookup cache doesn't take the descriptors needed by clients once they are available again.
+# Usage: ./test-nofile.py [<path-to-serwer>]
+#
+
+import http.client
+import os
+import socket
+import sys
+import time
+
+import serwer_test
+
+NOFILE = 64
+FILES_COUNT = 200
+# Clients connected after the server has run out of descriptors.
+EXTRA_CLIENTS = 2
+
+
+def cpu_seconds(pid):
+    with open("/proc/%d/stat" % pid) as f:
+        fields = f.read().split(")")[-1].split()
+    return (int(fields[11]) + int(fields[12])) / 100.0  # utime + stime, in clock ticks
+
+
+def open_files(pid):
+    fd_dir = "/proc/%d/fd" % pid
+    files = []
+    for fd in os.listdir(fd_dir):
+        try:
+            files.append(os.readlink(os.path.join(fd_dir, fd)))
+        except FileNotFoundError:  # Closed in the meantime.
+            pass
+    return files
+
+
+def wait_until(condition, timeout=5.0):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        if condition():
+            return True
+        time.sleep(0.05)
+    return False
+
+
+def get_status(connection, path):
+    connection.request("GET", path)
+    response = connection.getresponse()
+    response.read()
+    return response.status
+
+
+def main():
+    binary = sys.argv[1] if len(sys.argv) > 1 else serwer_test.build()
+    sizes = {"/file%03d" % i: 100 for i in range(FILES_COUNT)}
+    base_dir, servers_file = serwer_test.make_files(sizes)
+    server = serwer_test.Server(binary, base_dir, servers_file, nofile=NOFILE)
+    failures = []
+
+    connection = http.client.HTTPConnection("127.0.0.1", server.port, timeout=5)
+    if get_status(connection, "/file000") != 200:
+        failures.append("first request failed")
+    # Otherwise the descriptor of /file000 could leave the lookup cache after the idle clients took
+    # the other ones, and /file001 could be opened with it.
+    if not wait_until(lambda: not any(f.startswith(base_dir) for f in open_files(server.pid))):
+        failures.append("lookup cache kept a descriptor after its expiry")
+
+    # Idle clients take all descriptors of the server. Every client waits until the server accepts it,
+    # so that the listen backlog never fills up and connecting doesn't wait for SYN retransmissions.
+    idle = []
+    while len(open_files(server.pid)) < NOFILE and len(idle) < NOFILE:
+        count = len(open_files(server.pid))
+        idle.append(socket.create_connection(("127.0.0.1", server.port), timeout=5))
+        if not wait_until(lambda: len(open_files(server.pid)) > count):
+            break
+    # These ones stay in the backlog, the server can't accept them.
+    for _ in range(EXTRA_CLIENTS):
+        idle.append(socket.create_connection(("127.0.0.1", server.port), timeout=5))
+    if not wait_until(lambda: "pausing accepting" in server.read_log()):
+        failures.append("idle clients didn't take all descriptors of the server")
+    cpu_before = cpu_seconds(server.pid)
+    time.sleep(1.0)
+    cpu_used = cpu_seconds(server.pid) - cpu_before
+    if cpu_used > 0.3:
+        failures.append("server used %.2f s of CPU in 1 s while out of descriptors" % cpu_used)
+    status = get_status(connection, "/file001")
+    if status != 503:
+        failures.append("existing file answered with %d instead of 503 while out of descriptors" % status)
+
+    for sock in idle:
+        sock.close()
+    if not wait_until(lambda: len(open_files(server.pid)) < NOFILE // 2):
+        failures.append("server didn't close connections of the idle clients")
+    # Different files, so that the lookup cache fills up; it mustn't take descriptors needed for sending.
+    connection.close()
+    connection = http.client.HTTPConnection("127.0.0.1", server.port, timeout=5)
+    statuses = [get_status(connection, path) for path in sorted(sizes)]
+    if any(status != 200 for status in statuses):
+        failures.append("%d requests failed after descriptors were freed" % sum(s != 200 for s in statuses))
+    connection.close()
+
+    server.stop()
+    log = server.read_log()
+    print("pauses logged %d, 'accept error' logged %d" % (log.count("pausing accepting"), log.count("accept error")))
+    for failure in failures:
+        print("FAIL: " + failure)
+    if failures:
+        sys.exit(1)
+    print("PASS")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,62 @@
+#!/usr/bin/env python3
+#
+# Checks that a client which stops reading a big response doesn't stall other clients
+# and that its connection is closed after SEND_TIMEOUT_MS (10 s).
+# Usage: ./test-slow-client.py [<path-to-serwer>]
+#
+
+import http.client
+import socket
+import sys
+import time
+
+import serwer_test
+
+FILE_SIZES = {"/big": 64 * 1024 * 1024, "/small": 100}
+SEND_TIMEOUT = 10.0
+MAX_LATENCY = 0.5  # Of requests of other clients while the slow one is stuck, in seconds.
+
+
+def main():
+    binary = sys.argv[1] if len(sys.argv) > 1 else serwer_test.build()
+    base_dir, servers_file = serwer_test.make_files(FILE_SIZES)
+    server = serwer_test.Server(binary, base_dir, servers_file)
+    failures = []
+
+    slow = socket.create_connection(("127.0.0.1", server.port))
+    slow.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4096)
+    slow.sendall(b"GET /big HTTP/1.1\r\n\r\n")
+    time.sleep(0.5)  # The server fills the socket buffers and has to wait.
+
+    latencies = []
+    for _ in range(20):
+        start = time.time()
+        connection = http.client.HTTPConnection("127.0.0.1", server.port, timeout=5)
+        try:
+            connection.request("GET", "/small")
+            connection.getresponse().read()
+        except OSError as e:
+            failures.append("request of another client failed: %r" % e)
+            break
+        finally:
+            connection.close()
+        latencies.append(time.time() - start)
+    if latencies and max(latencies) > MAX_LATENCY:
+        failures.append("other clients waited up to %.2f s" % max(latencies))
+
+    time.sleep(SEND_TIMEOUT + 1.0)
+    if "Sending response timed out!" not in server.read_log():
+        failures.append("the stalled connection wasn't closed")
+    slow.close()
+    server.stop()
+
+    print("max latency of other clients %.3f s" % (max(latencies) if latencies else float("nan")))
+    for failure in failures:
+        print("FAIL: " + failure)
+    if failures:
+        sys.exit(1)
+    print("PASS")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,60 @@
+#!/usr/bin/env python3
+#
+# Checks that the server stopped with SIGTERM or SIGINT saves the popularity list,
+# so that hits recorded since the last periodic save (every POPULARITY_SAVE_INTERVAL hits) aren't lost.
+# Usage: ./test-stop.py [<path-to-serwer>]
+#
+
+import http.client
+import os
+import signal
+import subprocess
+import sys
+
+import serwer_test
+
+FILE_SIZES = {"/file": 100}
+HITS = 50  # Fewer than POPULARITY_SAVE_INTERVAL, so the list is saved only on the stop.
+STOP_TIMEOUT = 5.0
+
+
+def stop_saves_list(binary, base_dir, servers_file, stop_signal):
+    """Returns failure message, None if the list was saved."""
+    list_path = os.path.join(os.path.dirname(base_dir), "popularity-%s.txt" % stop_signal.name)
+    server = serwer_test.Server(binary, base_dir, servers_file, env={"SERWER_WARMUP_LIST": list_path})
+    connection = http.client.HTTPConnection("127.0.0.1", server.port, timeout=5)
+    for _ in range(HITS):
+        connection.request("GET", "/file")
+        connection.getresponse().read()
+    # An open connection mustn't keep the server from stopping.
+    os.kill(server.pid, stop_signal)
+    try:
+        server.process.wait(timeout=STOP_TIMEOUT)
+    except subprocess.TimeoutExpired:
+        return "server didn't exit within %.0f s after %s" % (STOP_TIMEOUT, stop_signal.name)
+    finally:
+        connection.close()
+    if not os.path.exists(list_path):
+        return "popularity list wasn't saved after %s" % stop_signal.name
+    with open(list_path) as f:
+        contents = f.read()
+    if contents != "%d /file\n" % HITS:
+        return "popularity list saved after %s contains %r" % (stop_signal.name, contents)
+    return None
+
+
+def main():
+    binary = sys.argv[1] if len(sys.argv) > 1 else serwer_test.build()
+    base_dir, servers_file = serwer_test.make_files(FILE_SIZES)
+    failures = [stop_saves_list(binary, base_dir, servers_file, stop_signal)
+                for stop_signal in (signal.SIGTERM, signal.SIGINT)]
+    failures = [failure for failure in failures if failure is not None]
+    for failure in failures:
+        print("FAIL: " + failure)
+    if failures:
+        sys.exit(1)
+    print("PASS")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,80 @@
+#!/usr/bin/env python3
+#
+# Generates a self-signed certificate, starts the server with HTTPS and checks that files downloaded
+# with "curl --cacert" are identical to the served ones, and that a TLS client which stops reading
+# a big file doesn't stall the other clients.
+# Usage: ./test-tls.py [<path-to-serwer>]
+#
+
+import filecmp
+import http.client
+import os
+import socket
+import ssl
+import subprocess
+import sys
+import time
+
+import serwer_test
+
+FILE_SIZES = {"/empty": 0, "/small": 100, "/chunks": 3 * 64 * 1024 + 1, "/big": 32 * 1024 * 1024}
+MAX_LATENCY = 0.5  # Of requests of other clients while the slow one is stuck, in seconds.
+
+
+def check_downloads(port, base_dir, cert, failures):
+    for path in FILE_SIZES:
+        output = os.path.join(os.path.dirname(base_dir), "downloaded")
+        result = subprocess.run(["curl", "--silent", "--show-error", "--cacert", cert, "--output", output,
+                                 "https://localhost:%d%s" % (port, path)], stderr=subprocess.PIPE, text=True)
+        if result.returncode != 0:
+            failures.append("curl %s failed: %s" % (path, result.stderr.strip()))
+        elif not filecmp.cmp(output, os.path.join(base_dir, path.lstrip("/")), shallow=False):
+            failures.append("%s downloaded over HTTPS differs from the served file" % path)
+
+
+def check_slow_client(port, context, failures):
+    raw = socket.create_connection(("127.0.0.1", port))
+    raw.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4096)
+    slow = context.wrap_socket(raw, server_hostname="localhost")
+    slow.sendall(b"GET /big HTTP/1.1\r\n\r\n")
+    time.sleep(0.5)  # The server fills the socket buffers and has to wait.
+
+    latencies = []
+    for _ in range(10):
+        start = time.time()
+        connection = http.client.HTTPSConnection("localhost", port, context=context, timeout=5)
+        try:
+            connection.request("GET", "/small")
+            connection.getresponse().read()
+        except OSError as e:
+            failures.append("request of another client failed: %r" % e)
+            break
+        finally:
+            connection.close()
+        latencies.append(time.time() - start)
+    slow.close()
+    if latencies and max(latencies) > MAX_LATENCY:
+        failures.append("other clients waited up to %.2f s" % max(latencies))
+
+
+def main():
+    binary = sys.argv[1] if len(sys.argv) > 1 else serwer_test.build()
+    base_dir, servers_file = serwer_test.make_files(FILE_SIZES)
+    cert, key = serwer_test.make_certificate(os.path.dirname(base_dir))
+    server = serwer_test.Server(binary, base_dir, servers_file, env=serwer_test.tls_env(cert, key))
+    failures = []
+    check_downloads(server.port, base_dir, cert, failures)
+    check_slow_client(server.port, ssl.create_default_context(cafile=cert), failures)
+    server.stop()
+
+    log = server.read_log()
+    print("kTLS %s" % ("enabled" if "kTLS enabled" in log else "not available"))
+    for failure in failures:
+        print("FAIL: " + failure)
+    if failures:
+        sys.exit(1)
+    print("PASS")
+
+
+if __name__ == "__main__":
+    main()
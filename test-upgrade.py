@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+#
+# Runs a load generator through two hot upgrades (SIGUSR2) and checks that no request failed,
+# that every upgrade started a new process and that the old processes exited.
+# The second run makes every new process take SLOW_START_MS to get ready (bench-slow-fs.c delays opening
+# the file with correlated servers) and checks that the old process keeps serving clients meanwhile.
+# Usage: ./test-upgrade.py [<path-to-serwer>]
+#
+
+import http.client
+import os
+import shutil
+import signal
+import sys
+import time
+
+import serwer_test
+
+DURATION = 6.0
+UPGRADE_TIMES = [2.0, 4.0]
+FILE_SIZES = {"/big": 200000, "/small": 3}
+SLOW_START_MS = 1500
+# Maximal latency of a request during an upgrade with the slow start, in seconds.
+MAX_LATENCY = 0.5
+
+
+def run_upgrades(binary, base_dir, servers_file, env=None, preload=None):
+    """Returns list of failures."""
+    server = serwer_test.Server(binary, base_dir, servers_file, env=env, preload=preload)
+    # The first process starts slowly too, that isn't measured.
+    connection = http.client.HTTPConnection("127.0.0.1", server.port, timeout=10)
+    connection.request("GET", "/small")
+    connection.getresponse().read()
+    connection.close()
+    load = serwer_test.Load(server.port, list(FILE_SIZES), clients=4,
+                            expected_sizes=FILE_SIZES).start()
+
+    start = time.time()
+    pids = [server.pid]
+    for upgrade_time in UPGRADE_TIMES:
+        time.sleep(max(0.0, start + upgrade_time - time.time()))
+        old_pid = pids[-1]
+        os.kill(old_pid, signal.SIGUSR2)
+        new_pids = []
+        deadline = time.time() + 5
+        while not new_pids and time.time() < deadline:
+            time.sleep(0.05)
+            new_pids = [pid for pid in server.find_pids() if pid not in pids]
+        if not new_pids:
+            load.stop()
+            server.stop(pids)
+            return ["upgrade of %d didn't start a new process" % old_pid]
+        pids.append(new_pids[0])
+    time.sleep(max(0.0, start + DURATION - time.time()))
+    load.stop()
+
+    # Old processes exit at the latest DRAIN_TIMEOUT_MS (5 s) after the upgrade.
+    time.sleep(1)
+    still_running = [pid for pid in pids[:-1] if serwer_test.is_alive(pid)]
+    is_new_alive = serwer_test.is_alive(pids[-1])
+    server.stop(pids[1:])
+
+    max_latency = max((latency for end, latency in load.latencies), default=float("nan"))
+    print("ok %d failed %d, max latency %.3f s, processes %s" % (load.ok, load.failed, max_latency, pids))
+    for error in load.errors[:5]:
+        print("  " + error)
+    failures = []
+    if load.failed > 0 or load.ok == 0:
+        failures.append("requests failed during the upgrade")
+    if still_running:
+        failures.append("old processes %s didn't exit" % still_running)
+    if not is_new_alive:
+        failures.append("the last process isn't running")
+    if preload is not None and max_latency > MAX_LATENCY:
+        failures.append("clients waited %.2f s while the new process was starting" % max_latency)
+    return failures
+
+
+def main():
+    binary = sys.argv[1] if len(sys.argv) > 1 else serwer_test.build()
+    base_dir, servers_file = serwer_test.make_files(FILE_SIZES)
+    failures = run_upgrades(binary, base_dir, servers_file)
+
+    slow_dir = os.path.join(os.path.dirname(base_dir), "slow")
+    os.mkdir(slow_dir)
+    slow_servers_file = shutil.copy(servers_file, slow_dir)
+    failures += run_upgrades(binary, base_dir, slow_servers_file, env={"SLOW_OPEN_MS": str(SLOW_START_MS)},
+                             preload=serwer_test.build_slow_fs_shim())
+
+    for failure in failures:
+        print("FAIL: " + failure)
+    if failures:
+        sys.exit(1)
+    print("PASS")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,166 @@
+#include "tls.h"
+#include "common.h"
+
+#include <iostream>
+#include <poll.h>
+#include <unistd.h>
+#include <openssl/err.h>
+
+// OpenSSL's error queue is per thread and SSL_get_error() consults it, so it is cleared
+// before every SSL_ call; otherwise an error left by one session would be reported by another.
+
+tls::Session::Session(SSL *ssl, int sock) : ssl(ssl), sock(sock), poll_events(POLLIN) {}
+
+tls::Session::~Session() {
+    if (is_established) {
+        ERR_clear_error();
+        SSL_shutdown(ssl); // Best effort, the socket is closed right afterwards anyway.
+        ERR_clear_error();
+    }
+    SSL_free(ssl);
+}
+
+ssize_t tls::Session::handle_write_error(int ret) {
+    switch (SSL_get_error(ssl, ret)) {
+        case SSL_ERROR_WANT_READ:
+            poll_events = POLLIN;
+            return 0;
+        case SSL_ERROR_WANT_WRITE:
+            poll_events = POLLOUT;
+            return 0;
+        default:
+            ERR_clear_error();
+            return -1;
+    }
+}
+
+int tls::Session::handshake() {
+    ERR_clear_error();
+    int ret = SSL_accept(ssl);
+    if (ret == 1) {
+        is_established = true;
+        is_ktls_send = BIO_get_ktls_send(SSL_get_wbio(ssl));
+        poll_events = POLLIN;
+        std::cout << "TLS handshake done, kTLS " << (is_ktls_send ? "enabled." : "not available.") << std::endl;
+        return 1;
+    }
+    switch (SSL_get_error(ssl, ret)) {
+        case SSL_ERROR_WANT_READ:
+            poll_events = POLLIN;
+            return 0;
+        case SSL_ERROR_WANT_WRITE:
+            poll_events = POLLOUT;
+            return 0;
+        default:
+            std::cerr << "TLS handshake failed!" << std::endl;
+            ERR_clear_error();
+            return -1;
+    }
+}
+
+bool tls::Session::read(std::string &input) {
+    char buffer[READ_BUFFER_SIZE];
+    for (;;) {
+        size_t read_bytes;
+        ERR_clear_error();
+        int ret = SSL_read_ex(ssl, buffer, sizeof(buffer), &read_bytes);
+        if (ret == 1) {
+            input.append(buffer, read_bytes);
+            continue;
+        }
+        switch (SSL_get_error(ssl, ret)) {
+            case SSL_ERROR_WANT_READ:
+                poll_events = POLLIN;
+                return true;
+            case SSL_ERROR_WANT_WRITE:
+                poll_events = POLLOUT;
+                return true;
+            case SSL_ERROR_ZERO_RETURN: // Client sent close_notify.
+                return false;
+            default:
+                ERR_clear_error();
+                return false;
+        }
+    }
+}
+
+ssize_t tls::Session::write(const char *data, size_t size) {
+    size_t written_bytes;
+    ERR_clear_error();
+    int ret = SSL_write_ex(ssl, data, size, &written_bytes);
+    if (ret != 1)
+        return handle_write_error(ret);
+    poll_events = POLLIN;
+    return (ssize_t) written_bytes;
+}
+
+ssize_t tls::Session::send_file(int file_descriptor, off_t offset, size_t size) {
+    if (is_ktls_send) {
+        ERR_clear_error();
+        ossl_ssize_t sent_bytes = SSL_sendfile(ssl, file_descriptor, offset, size, 0);
+        if (sent_bytes <= 0)
+            return handle_write_error((int) sent_bytes);
+        poll_events = POLLIN;
+        return sent_bytes;
+    }
+
+    if (file_chunk.empty()) {
+        file_chunk.resize(std::min(size, (size_t) TLS_FILE_CHUNK_SIZE));
+        ssize_t read_bytes = pread(file_descriptor, file_chunk.data(), file_chunk.size(), offset);
+        if (read_bytes <= 0) {
+            file_chunk.clear();
+            return -1;
+        }
+        file_chunk.resize(read_bytes);
+        file_chunk_sent = 0;
+    }
+    ssize_t sent_bytes = write(file_chunk.data() + file_chunk_sent, file_chunk.size() - file_chunk_sent);
+    if (sent_bytes > 0) {
+        file_chunk_sent += sent_bytes;
+        if (file_chunk_sent == file_chunk.size())
+            file_chunk.clear();
+    }
+    return sent_bytes;
+}
+
+tls::Context::~Context() {
+    SSL_CTX_free(ctx);
+}
+
+void tls::Context::init_from_env() {
+    const char *cert_path = getenv(TLS_CERT_ENV);
+    const char *key_path = getenv(TLS_KEY_ENV);
+    if (cert_path == nullptr && key_path == nullptr)
+        return;
+    if (cert_path == nullptr || key_path == nullptr)
+        exit_error("Both " TLS_CERT_ENV " and " TLS_KEY_ENV " have to be set!");
+
+    ctx = SSL_CTX_new(TLS_server_method());
+    if (ctx == nullptr)
+        exit_error("SSL_CTX_new error");
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    // Writes return as soon as a record has been sent, so that the event loop can track progress;
+    // the data passed to a repeated write may be at another address (e.g. a reallocated string).
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    // OpenSSL switches the socket to kTLS after the handshake, if the kernel and the cipher support it.
+    const char *ktls = getenv(TLS_KTLS_ENV);
+    if (ktls == nullptr || std::string(ktls) != "0")
+        SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+    if (SSL_CTX_use_certificate_chain_file(ctx, cert_path) != 1 ||
+        SSL_CTX_use_PrivateKey_file(ctx, key_path, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(ctx) != 1) {
+        ERR_print_errors_fp(stderr);
+        exit_error("Loading TLS certificate or key failed!");
+    }
+}
+
+std::unique_ptr<tls::Session> tls::Context::new_session(int sock) {
+    SSL *ssl = SSL_new(ctx);
+    if (ssl == nullptr)
+        return nullptr;
+    if (SSL_set_fd(ssl, sock) != 1) {
+        SSL_free(ssl);
+        return nullptr;
+    }
+    return std::make_unique<Session>(ssl, sock);
+}
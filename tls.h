@@ -0,0 +1,107 @@
+#ifndef ZADANIE_1_TLS_H
+#define ZADANIE_1_TLS_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <openssl/ssl.h>
+
+// Names of the environment variables with paths to PEM files with the server certificate (chain)
+// and its private key. When both are set, the server speaks HTTPS instead of HTTP.
+#define TLS_CERT_ENV "SERWER_TLS_CERT"
+#define TLS_KEY_ENV "SERWER_TLS_KEY"
+// Name of the environment variable which disables kernel TLS when set to "0" (e.g. to compare performance).
+#define TLS_KTLS_ENV "SERWER_KTLS"
+// Size of the chunks in which files are encrypted when kernel TLS is not available.
+#define TLS_FILE_CHUNK_SIZE (64 * 1024)
+
+// TLS termination. Handshakes are done by OpenSSL in user space. After the handshake OpenSSL
+// tries to hand record encryption over to the kernel (kTLS, setsockopt(TCP_ULP, "tls")),
+// so that files can still be sent with sendfile(). When kTLS is not available
+// (kernel without the tls module, unsupported cipher), files are encrypted in user space.
+namespace tls {
+    // TLS connection with a single client. The client socket has to be non-blocking, so that a slow client
+    // doesn't stall the event loop. Calls which can't proceed return and tell for which events
+    // the socket should be polled before they are repeated.
+    class Session {
+        SSL *ssl;
+        int sock;
+        bool is_established = false;
+        bool is_ktls_send = false;
+        short poll_events; // Events the session waits for.
+        // Part of a file read for send_file() without kTLS, kept until it has been sent,
+        // because SSL_write() has to be repeated with the same data.
+        std::vector<char> file_chunk;
+        size_t file_chunk_sent = 0;
+
+        // Handles failed SSL_ call which returned 'ret'. Returns 0 (setting 'poll_events') if the call
+        // has to be repeated when the socket is ready and -1 if it failed.
+        ssize_t handle_write_error(int ret);
+
+    public:
+        Session(SSL *ssl, int sock);
+
+        Session(const Session &) = delete;
+
+        Session &operator=(const Session &) = delete;
+
+        ~Session();
+
+        [[nodiscard]] bool is_handshake_done() const {
+            return is_established;
+        }
+
+        // Events (POLLIN or POLLOUT) for which the socket should be polled before calling
+        // handshake(), read(), write() or send_file() again.
+        [[nodiscard]] short get_poll_events() const {
+            return poll_events;
+        }
+
+        // Continues the handshake. Returns 1 when the handshake is done, 0 if it needs to wait for the socket
+        // and -1 if it failed.
+        int handshake();
+
+        // Reads all decrypted data available now and appends it to 'input' (which may stay unchanged,
+        // if no complete record has been received yet).
+        // Returns 'false' if the client closed the connection or reading failed.
+        bool read(std::string &input);
+
+        // Sends at most 'size' bytes of 'data'. Returns the number of bytes sent, 0 if the socket isn't ready
+        // (then the call has to be repeated with the same data) and -1 if sending failed.
+        ssize_t write(const char *data, size_t size);
+
+        // Sends at most 'size' bytes of file 'file_descriptor' starting at 'offset', using sendfile()
+        // when kTLS is enabled. Returns the same values as write().
+        ssize_t send_file(int file_descriptor, off_t offset, size_t size);
+    };
+
+    // TLS configuration of the server, shared by all sessions.
+    class Context {
+        SSL_CTX *ctx = nullptr;
+
+    public:
+        Context() = default;
+
+        Context(const Context &) = delete;
+
+        Context &operator=(const Context &) = delete;
+
+        ~Context();
+
+        // Loads certificate and private key from files whose paths are in TLS_CERT_ENV and TLS_KEY_ENV.
+        // Does nothing if the variables are not set. Exits the program with EXIT_FAILURE if loading failed.
+        // Enables kTLS unless TLS_KTLS_ENV is "0".
+        void init_from_env();
+
+        [[nodiscard]] bool is_enabled() const {
+            return ctx != nullptr;
+        }
+
+        // Creates new session for non-blocking client socket 'sock'. Returns nullptr on failure.
+        std::unique_ptr<Session> new_session(int sock);
+    };
+}
+
+#endif //ZADANIE_1_TLS_H
@@ -0,0 +1,153 @@
+#include "trace.h"
+
+#ifdef SERWER_TRACE
+
+#ifndef TRACE_HAS_PROBES
+#warning "<sys/sdt.h> not found (install systemtap-sdt-dev), static tracepoints are not compiled in"
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+std::atomic<bool> trace::enabled(false);
+volatile sig_atomic_t trace::dump_requested = 0;
+
+namespace {
+    struct Event {
+        const char *name;
+        pid_t tid;
+        uint64_t begin, end;
+    };
+
+    struct Buffer {
+        // Taken only by the owning thread and check_dump(), so it is almost never contended.
+        std::mutex mutex;
+        std::array<Event, TRACE_BUFFER_SIZE> events;
+        size_t next = 0; // Total number of events recorded, events[next % TRACE_BUFFER_SIZE] is the oldest one.
+    };
+
+    // Buffers of all threads that recorded something. Buffers of threads that finished
+    // are kept (so that their events can be dumped) and reused by new threads.
+    std::mutex registry_mutex;
+    std::vector<std::unique_ptr<Buffer>> buffers;
+    std::vector<Buffer *> free_buffers;
+
+    // Gets a buffer from the registry for the lifetime of the thread.
+    class BufferLease {
+        Buffer *buffer;
+
+    public:
+        BufferLease() {
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            if (free_buffers.empty()) {
+                buffers.push_back(std::make_unique<Buffer>());
+                buffer = buffers.back().get();
+            } else {
+                buffer = free_buffers.back();
+                free_buffers.pop_back();
+            }
+        }
+
+        ~BufferLease() {
+            std::lock_guard<std::mutex> lock(registry_mutex);
+            free_buffers.push_back(buffer);
+        }
+
+        Buffer &get() {
+            return *buffer;
+        }
+    };
+
+    void handle_sigusr1(int) {
+        trace::dump_requested = 1;
+    }
+
+    std::string escape_json(const std::string &s) {
+        std::string escaped;
+        for (char c : s) {
+            if (c == '"' || c == '\\')
+                escaped.push_back('\\');
+            escaped.push_back(c);
+        }
+        return escaped;
+    }
+}
+
+void trace::init() {
+    const char *trace_env = getenv(TRACE_ENV);
+    enabled = trace_env != nullptr && std::string(trace_env) == "1";
+
+    struct sigaction action{};
+    action.sa_handler = handle_sigusr1;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = 0;
+    if (sigaction(SIGUSR1, &action, nullptr) < 0) {
+        std::cerr << "sigaction error" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+uint64_t trace::now() {
+    struct timespec ts{};
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void trace::record(const char *name, uint64_t begin, uint64_t end) {
+    thread_local BufferLease lease;
+    thread_local pid_t tid = (pid_t) syscall(SYS_gettid);
+    Buffer &buffer = lease.get();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.events[buffer.next++ % TRACE_BUFFER_SIZE] = {name, tid, begin, end};
+}
+
+void trace::check_dump() {
+    if (!dump_requested)
+        return;
+    dump_requested = 0;
+
+    std::vector<Event> events;
+    {
+        std::lock_guard<std::mutex> registry_lock(registry_mutex);
+        for (auto &buffer : buffers) {
+            std::lock_guard<std::mutex> lock(buffer->mutex);
+            size_t count = std::min(buffer->next, (size_t) TRACE_BUFFER_SIZE);
+            for (size_t i = buffer->next - count; i < buffer->next; i++)
+                events.push_back(buffer->events[i % TRACE_BUFFER_SIZE]);
+        }
+    }
+    std::sort(events.begin(), events.end(), [](const Event &a, const Event &b) {
+        return a.begin < b.begin;
+    });
+
+    pid_t pid = getpid();
+    std::string path = TRACE_DUMP_PREFIX + std::to_string(pid) + ".json";
+    std::ofstream f(path, std::ios::trunc);
+    // Complete events ("ph": "X"), timestamps and durations in microseconds.
+    f << "{\"traceEvents\":[";
+    for (size_t i = 0; i < events.size(); i++) {
+        const Event &e = events[i];
+        f << (i == 0 ? "" : ",") << "\n{\"name\":\"" << escape_json(e.name) << "\",\"ph\":\"X\""
+          << ",\"ts\":" << e.begin / 1000 << "." << e.begin % 1000 / 100
+          << ",\"dur\":" << (e.end - e.begin) / 1000 << "." << (e.end - e.begin) % 1000 / 100
+          << ",\"pid\":" << pid << ",\"tid\":" << e.tid << "}";
+    }
+    f << "\n]}\n";
+    f.close();
+    if (f.fail())
+        std::cerr << "Writing trace to " << path << " failed!" << std::endl;
+    else
+        std::cout << "Trace written to " << path << std::endl;
+}
+
+#endif //SERWER_TRACE
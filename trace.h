@@ -0,0 +1,94 @@
+#ifndef ZADANIE_1_TRACE_H
+#define ZADANIE_1_TRACE_H
+
+// Tracing of the stages of request handling.
+// Compiled in only when SERWER_TRACE is defined (make TRACE=1); otherwise TRACE_STAGE expands to nothing.
+// When compiled in:
+// - static tracepoints serwer:stage_begin and serwer:stage_end (with the stage name as an argument)
+//   are placed at the stage boundaries, so that perf and bpftrace can attach to them
+//   (requires <sys/sdt.h> from systemtap-sdt-dev at build time),
+// - if TRACE_ENV is set to "1", every thread records the stages it went through in its ring buffer.
+//   Sending SIGUSR1 to the server dumps the buffers to TRACE_DUMP_PREFIX<pid>.json
+//   in Chrome trace event format (readable by chrome://tracing and Perfetto).
+
+#ifdef SERWER_TRACE
+
+#include <atomic>
+#include <csignal>
+#include <cstdint>
+
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define TRACE_HAS_PROBES
+#define TRACE_PROBE(probe, stage) DTRACE_PROBE1(serwer, probe, stage)
+#else
+// Ring buffers still work; trace.cpp warns that the build has no tracepoints.
+#define TRACE_PROBE(probe, stage)
+#endif
+
+// Name of the environment variable that enables recording stages at runtime.
+#define TRACE_ENV "SERWER_TRACE"
+// Number of stages remembered by every thread.
+#define TRACE_BUFFER_SIZE 4096
+#define TRACE_DUMP_PREFIX "serwer-trace-"
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+// Traces the rest of the enclosing scope as stage 'name' (a string literal).
+#define TRACE_STAGE(name) trace::Scope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+
+namespace trace {
+    // Whether stages are recorded to ring buffers.
+    extern std::atomic<bool> enabled;
+    // Set to 1 by SIGUSR1 handler.
+    extern volatile sig_atomic_t dump_requested;
+
+    // Enables recording if TRACE_ENV is set and installs SIGUSR1 handler.
+    void init();
+
+    // Returns current time in nanoseconds, measured with CLOCK_MONOTONIC_RAW.
+    uint64_t now();
+
+    // Records stage 'name' that started at 'begin' and ended at 'end' in the ring buffer of the calling thread.
+    void record(const char *name, uint64_t begin, uint64_t end);
+
+    // If dump was requested, writes ring buffers of all threads to TRACE_DUMP_PREFIX<pid>.json.
+    void check_dump();
+
+    // Records the stage from its construction to its destruction.
+    class Scope {
+        const char *name;
+        uint64_t begin = 0;
+
+    public:
+        explicit Scope(const char *name) : name(name) {
+            TRACE_PROBE(stage_begin, name);
+            if (enabled.load(std::memory_order_relaxed))
+                begin = now();
+        }
+
+        Scope(const Scope &) = delete;
+
+        Scope &operator=(const Scope &) = delete;
+
+        ~Scope() {
+            TRACE_PROBE(stage_end, name);
+            if (begin != 0)
+                record(name, begin, now());
+        }
+    };
+}
+
+#else
+
+#define TRACE_STAGE(name)
+
+namespace trace {
+    inline void init() {}
+
+    inline void check_dump() {}
+}
+
+#endif //SERWER_TRACE
+
+#endif //ZADANIE_1_TRACE_H
@@ -0,0 +1,190 @@
+#include "upgrade.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+volatile sig_atomic_t upgrade::requested = 0;
+
+namespace {
+    // Command line of the new process.
+    std::vector<std::string> args;
+    // Descriptor of the Unix socket connected to the old process, -1 if there is no old process.
+    int old_process_channel = -1;
+    // Process started by start_hand_off() and the Unix socket connected to it, while waiting for its confirmation.
+    pid_t new_process_pid = -1;
+    int new_process_channel = -1;
+
+    void handle_sigusr2(int) {
+        upgrade::requested = 1;
+    }
+
+    void upgrade_error(const std::string &message) {
+        std::cerr << "Upgrade failed: " << message << " (" << strerror(errno) << ")" << std::endl;
+    }
+
+    // Sends 'fd' over Unix socket 'channel'. Returns 'true' on success.
+    bool send_fd(int channel, int fd) {
+        char data = 0;
+        struct iovec iov = {&data, sizeof(data)};
+        char control[CMSG_SPACE(sizeof(int))];
+        memset(control, 0, sizeof(control));
+
+        struct msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+        return sendmsg(channel, &msg, 0) == sizeof(data);
+    }
+
+    // Receives descriptor sent with send_fd() over 'channel'. Returns -1 on failure.
+    int receive_fd(int channel) {
+        char data;
+        struct iovec iov = {&data, sizeof(data)};
+        char control[CMSG_SPACE(sizeof(int))];
+
+        struct msghdr msg{};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(channel, &msg, MSG_CMSG_CLOEXEC) != sizeof(data))
+            return -1;
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (cmsg == nullptr || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            return -1;
+        int fd;
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        return fd;
+    }
+
+    // Kills the new process (which hasn't become ready) and forgets it.
+    void kill_new_process() {
+        close(new_process_channel);
+        new_process_channel = -1;
+        kill(new_process_pid, SIGKILL);
+        waitpid(new_process_pid, nullptr, 0);
+        new_process_pid = -1;
+    }
+}
+
+void upgrade::init(char **argv) {
+    for (char **arg = argv; *arg != nullptr; arg++)
+        args.emplace_back(*arg);
+
+    struct sigaction action{};
+    action.sa_handler = handle_sigusr2;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = 0; // No SA_RESTART, so that waiting for clients is interrupted.
+    if (sigaction(SIGUSR2, &action, nullptr) < 0) {
+        std::cerr << "sigaction error" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+int upgrade::receive_listening_socket() {
+    const char *channel_str = getenv(UPGRADE_FD_ENV);
+    if (channel_str == nullptr)
+        return -1;
+    old_process_channel = atoi(channel_str);
+    unsetenv(UPGRADE_FD_ENV);
+    fcntl(old_process_channel, F_SETFD, FD_CLOEXEC);
+
+    int sock = receive_fd(old_process_channel);
+    if (sock < 0) {
+        std::cerr << "Receiving listening socket from the old process failed!" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    std::cout << "Received listening socket from the old process." << std::endl;
+    return sock;
+}
+
+void upgrade::confirm_ready() {
+    if (old_process_channel < 0)
+        return;
+    char ack = 0;
+    if (write(old_process_channel, &ack, sizeof(ack)) != sizeof(ack))
+        std::cerr << "Confirming upgrade failed!" << std::endl;
+    close(old_process_channel);
+    old_process_channel = -1;
+}
+
+int upgrade::start_hand_off(int listen_sock) {
+    int channel[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, channel) < 0) {
+        upgrade_error("socketpair");
+        return -1;
+    }
+
+    // Everything the child needs is prepared before fork(), so that it only calls fcntl() and execvpe().
+    std::vector<char *> argv;
+    for (std::string &arg : args)
+        argv.push_back(arg.data());
+    argv.push_back(nullptr);
+    std::string channel_env = std::string(UPGRADE_FD_ENV) + "=" + std::to_string(channel[1]);
+    std::vector<char *> envp;
+    for (char **env = environ; *env != nullptr; env++) {
+        if (strncmp(*env, UPGRADE_FD_ENV "=", strlen(UPGRADE_FD_ENV "=")) != 0)
+            envp.push_back(*env);
+    }
+    envp.push_back(channel_env.data());
+    envp.push_back(nullptr);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        upgrade_error("fork");
+        close(channel[0]);
+        close(channel[1]);
+        return -1;
+    }
+    if (pid == 0) {
+        fcntl(channel[1], F_SETFD, 0);
+        execvpe(argv[0], argv.data(), envp.data());
+        _exit(EXIT_FAILURE);
+    }
+
+    close(channel[1]);
+    new_process_pid = pid;
+    new_process_channel = channel[0];
+    if (!send_fd(new_process_channel, listen_sock)) {
+        upgrade_error("sending listening socket");
+        kill_new_process();
+        return -1;
+    }
+    return new_process_channel;
+}
+
+bool upgrade::finish_hand_off() {
+    char ack;
+    if (read(new_process_channel, &ack, sizeof(ack)) != sizeof(ack)) {
+        std::cerr << "Upgrade failed: new process didn't become ready." << std::endl;
+        kill_new_process();
+        return false;
+    }
+    close(new_process_channel);
+    new_process_channel = -1;
+    new_process_pid = -1;
+    return true;
+}
+
+void upgrade::abort_hand_off() {
+    std::cerr << "Upgrade failed: new process didn't become ready in time." << std::endl;
+    kill_new_process();
+}
@@ -0,0 +1,48 @@
+#ifndef ZADANIE_1_UPGRADE_H
+#define ZADANIE_1_UPGRADE_H
+
+#include <csignal>
+
+// Name of the environment variable through which the new process gets
+// its end of the Unix socket connecting it with the old process.
+#define UPGRADE_FD_ENV "SERWER_UPGRADE_FD"
+// How long the old process waits for the new one to become ready.
+#define UPGRADE_ACK_TIMEOUT_MS 10000
+// How long the old process keeps serving its open connections after the upgrade.
+#define DRAIN_TIMEOUT_MS 5000
+
+// Hot upgrade of the server without closing the listening socket.
+// Sending SIGUSR2 to the running server starts a new server process (the binary found under argv[0],
+// with the same arguments) and passes it the listening socket over a Unix socket using SCM_RIGHTS.
+// When the new process confirms it is ready, the old one stops accepting clients
+// and drains its open connection. The old process keeps serving clients while waiting for the confirmation.
+namespace upgrade {
+    // Set to 1 by SIGUSR2 handler.
+    extern volatile sig_atomic_t requested;
+
+    // Remembers command line arguments used to start a new process and installs SIGUSR2 handler.
+    void init(char **argv);
+
+    // If this process was started by an upgrade, receives listening socket from the old process
+    // and returns its descriptor. Otherwise returns -1.
+    // Exits the program with EXIT_FAILURE if receiving the socket failed.
+    int receive_listening_socket();
+
+    // Informs the old process (if there is any) that this process is ready to accept clients.
+    void confirm_ready();
+
+    // Starts new server process and passes 'listen_sock' to it. Returns descriptor which becomes readable
+    // when the new process confirms it is ready (or exits), -1 if starting it failed.
+    // Then finish_hand_off() or, after UPGRADE_ACK_TIMEOUT_MS, abort_hand_off() has to be called.
+    int start_hand_off(int listen_sock);
+
+    // Reads the confirmation of the new process after the descriptor returned by start_hand_off()
+    // became readable. Returns 'true' if the new process is ready to accept clients, 'false' otherwise
+    // (in which case this process should keep serving clients).
+    bool finish_hand_off();
+
+    // Gives up waiting for the new process and kills it.
+    void abort_hand_off();
+}
+
+#endif //ZADANIE_1_UPGRADE_H
@@ -0,0 +1,207 @@
+#include "warmup.h"
+#include "http.h"
+#include "file_utils.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <set>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+namespace {
+    // From linux/ioprio.h, which is not always installed.
+    const int IOPRIO_CLASS_IDLE = 3;
+    const int IOPRIO_CLASS_SHIFT = 13;
+    const int IOPRIO_WHO_PROCESS = 1;
+
+    // Gives the calling thread the lowest CPU and disk priority, so that it doesn't compete with clients.
+    void lower_thread_priority() {
+        auto tid = (id_t) syscall(SYS_gettid);
+        setpriority(PRIO_PROCESS, tid, 19);
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+    }
+}
+
+warmup::Popularity::Popularity(std::string list_path) : list_path(std::move(list_path)) {
+    std::ifstream f(this->list_path);
+    size_t count;
+    std::string request_target;
+    while (f >> count >> request_target) {
+        if (count / 2 > 0)
+            hits[request_target] = count / 2;
+    }
+}
+
+std::vector<std::string> warmup::Popularity::get_hottest() const {
+    std::vector<std::pair<size_t, std::string>> sorted;
+    for (const auto &[request_target, count] : hits)
+        sorted.emplace_back(count, request_target);
+    std::sort(sorted.begin(), sorted.end(), std::greater<>());
+    if (sorted.size() > POPULARITY_LIST_SIZE)
+        sorted.resize(POPULARITY_LIST_SIZE);
+
+    std::vector<std::string> hottest;
+    for (const auto &entry : sorted)
+        hottest.push_back(entry.second);
+    return hottest;
+}
+
+std::string warmup::Popularity::serialize() const {
+    std::string contents;
+    for (const std::string &request_target : get_hottest())
+        contents += std::to_string(hits.at(request_target)) + http::SP + request_target + "\n";
+    return contents;
+}
+
+void warmup::Popularity::write_list(const std::string &list_path, const std::string &contents,
+                                    uint64_t generation) {
+    // Saves from the event loop and from FsPool may overlap; they share the temporary file
+    // and an older snapshot mustn't replace a newer one.
+    static std::mutex mutex;
+    static uint64_t written_generation = 0;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (generation <= written_generation)
+        return;
+    // Writing to a temporary file and renaming it, so that the list is never read half-written.
+    // The name contains pid, because the old process may still be saving during an upgrade.
+    std::string tmp_path = list_path + "." + std::to_string(getpid()) + ".tmp";
+    std::ofstream f(tmp_path, std::ios::trunc);
+    f << contents;
+    f.close();
+    if (f.fail() || rename(tmp_path.c_str(), list_path.c_str()) < 0) {
+        std::cerr << "Saving popularity list failed!" << std::endl;
+        unlink(tmp_path.c_str());
+        return;
+    }
+    written_generation = generation;
+}
+
+void warmup::Popularity::record_hit(const std::string &request_target, FsPool &fs_pool) {
+    if (!is_enabled())
+        return;
+    hits[request_target]++;
+    if (++hits_since_save < POPULARITY_SAVE_INTERVAL || is_saving || is_handed_over)
+        return;
+    hits_since_save = 0;
+    is_saving = true;
+    fs_pool.submit([path = list_path, contents = serialize(), generation = ++save_generation] {
+        write_list(path, contents, generation);
+    }, [this] {
+        is_saving = false;
+    });
+}
+
+void warmup::Popularity::save() {
+    if (!is_enabled() || is_handed_over)
+        return;
+    hits_since_save = 0;
+    write_list(list_path, serialize(), ++save_generation);
+}
+
+void warmup::Popularity::hand_over() {
+    is_handed_over = true;
+}
+
+warmup::Warmer::~Warmer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopped = true;
+    }
+    cv.notify_all();
+    space_cv.notify_all();
+    for (std::thread &thread : threads)
+        thread.join();
+}
+
+void warmup::Warmer::start(const std::string &base_directory, const std::vector<std::string> &hottest) {
+    next_read = std::chrono::steady_clock::now();
+    threads.emplace_back(&Warmer::walk, this, base_directory, hottest);
+    for (int i = 0; i < WARMUP_THREADS; i++)
+        threads.emplace_back(&Warmer::read_ahead, this);
+}
+
+void warmup::Warmer::walk(const std::string &base_directory, const std::vector<std::string> &hottest) {
+    lower_thread_priority();
+    auto push = [this](const std::string &path) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            space_cv.wait(lock, [this] { return stopped || queue.size() < WARMUP_QUEUE_SIZE; });
+            if (stopped)
+                return false;
+            queue.push_back(path);
+        }
+        cv.notify_one();
+        return true;
+    };
+
+    std::set<std::string> queued;
+    bool is_running = true;
+    for (const std::string &request_target : hottest) {
+        if (!is_running)
+            break;
+        std::string path = base_directory + request_target;
+        if (!Request::check_req_target(request_target) || !file_utils::is_subpath_of(base_directory, path))
+            continue;
+        std::error_code ec;
+        if (!file_utils::fs::is_regular_file(path, ec))
+            continue;
+        try {
+            if (queued.insert(file_utils::canonize(path)).second)
+                is_running = push(path);
+        } catch (const file_utils::NoDirException &noDirException) {
+            // File has been removed in the meantime.
+        }
+    }
+
+    std::error_code ec;
+    file_utils::fs::recursive_directory_iterator it(
+            base_directory, file_utils::fs::directory_options::skip_permission_denied, ec), end;
+    for (; is_running && !ec && it != end; it.increment(ec)) {
+        std::error_code status_ec;
+        if (!file_utils::fs::is_regular_file(it->symlink_status(status_ec)))
+            continue;
+        std::string path = it->path().string();
+        if (queued.find(path) == queued.end())
+            is_running = push(path);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        walk_finished = true;
+    }
+    cv.notify_all();
+}
+
+void warmup::Warmer::read_ahead() {
+    lower_thread_priority();
+    for (;;) {
+        std::string path;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this] { return stopped || walk_finished || !queue.empty(); });
+            if (stopped || queue.empty())
+                return;
+            path = std::move(queue.front());
+            queue.pop_front();
+        }
+        space_cv.notify_one();
+
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            continue;
+        struct stat st{};
+        if (fstat(fd, &st) == 0 && throttle(st.st_size))
+            posix_fadvise(fd, 0, st.st_size, POSIX_FADV_WILLNEED);
+        close(fd);
+    }
+}
+
+bool warmup::Warmer::throttle(size_t size) {
+    std::unique_lock<std::mutex> lock(mutex);
+    auto now = std::chrono::steady_clock::now();
+    auto start = std::max(now, next_read);
+    next_read = start + std::chrono::microseconds(size * 1000000 / WARMUP_BYTES_PER_SEC);
+    return !cv.wait_until(lock, start, [this] { return stopped; });
+}
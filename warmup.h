@@ -0,0 +1,118 @@
+#ifndef ZADANIE_1_WARMUP_H
+#define ZADANIE_1_WARMUP_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "fs_pool.h"
+
+// Name of the environment variable containing path to the popularity list.
+// When set, the server warms the page cache on startup and records popularity of resources.
+#define WARMUP_LIST_ENV "SERWER_WARMUP_LIST"
+// Number of threads reading files ahead.
+#define WARMUP_THREADS 2
+// Upper bound on the speed of reading ahead, so that warm-up doesn't starve clients of disk bandwidth.
+#define WARMUP_BYTES_PER_SEC (64 * 1024 * 1024)
+// Popularity list is saved after every POPULARITY_SAVE_INTERVAL hits.
+#define POPULARITY_SAVE_INTERVAL 1000
+// Maximal number of resources saved in the popularity list.
+#define POPULARITY_LIST_SIZE 1000
+// Maximal number of paths found by walking the base directory that wait to be read ahead.
+#define WARMUP_QUEUE_SIZE 1024
+
+// Warming the page cache after the server starts, so that first requests don't hit cold disk.
+namespace warmup {
+    // Counts how many times each resource has been sent and saves the counts to a file,
+    // which lets the next run warm the most popular resources first.
+    // File format: one "<count> <request-target>" pair per line, most popular first.
+    class Popularity {
+        std::string list_path;
+        std::map<std::string, size_t> hits; // Maps request targets to their hit counts.
+        size_t hits_since_save = 0;
+        bool is_saving = false; // Whether a save submitted to FsPool hasn't finished yet.
+        // Set after the upgrade, when the list belongs to the new process.
+        bool is_handed_over = false;
+        uint64_t save_generation = 0; // Increased with every save, see write_list().
+
+        // Returns contents of the list file.
+        [[nodiscard]] std::string serialize() const;
+
+        // Writes 'contents' to 'list_path' through a temporary file, unless contents of a later
+        // 'generation' have already been written by this process. May be called from any thread.
+        static void write_list(const std::string &list_path, const std::string &contents, uint64_t generation);
+
+    public:
+        Popularity() = default;
+
+        // Loads counts saved by the previous run from 'list_path'. Old counts are halved,
+        // so that resources that stopped being popular eventually drop out of the list.
+        explicit Popularity(std::string list_path);
+
+        [[nodiscard]] bool is_enabled() const {
+            return !list_path.empty();
+        }
+
+        // Returns request targets sorted from the most popular.
+        [[nodiscard]] std::vector<std::string> get_hottest() const;
+
+        // Records that 'request_target' has been sent. Every POPULARITY_SAVE_INTERVAL hits
+        // saves the list in 'fs_pool', so that writing the file doesn't block the caller.
+        void record_hit(const std::string &request_target, FsPool &fs_pool);
+
+        // Saves the list to the file now. Errors are only reported, since the list is just a hint.
+        void save();
+
+        // Stops saving the list, after it has been saved for the process started by an upgrade,
+        // which from then on records popularity in the same file.
+        void hand_over();
+    };
+
+    // Background threads reading ahead files from the base directory.
+    // Walking the directory tree primes kernel's path and metadata (dentry and inode) caches,
+    // posix_fadvise(WILLNEED) makes the kernel read file contents into the page cache.
+    class Warmer {
+        std::vector<std::thread> threads;
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::condition_variable space_cv; // Notified when a path is taken from the queue.
+        std::deque<std::string> queue; // Paths of files waiting to be read ahead, at most WARMUP_QUEUE_SIZE.
+        bool walk_finished = false;
+        bool stopped = false;
+        // Time before which next file shouldn't be read ahead (used for throttling).
+        std::chrono::steady_clock::time_point next_read;
+
+        // Queues 'hottest' resources first, then the rest of the files found in 'base_directory'.
+        // Waits while the queue is full, so that a huge tree isn't held in memory.
+        void walk(const std::string &base_directory, const std::vector<std::string> &hottest);
+
+        // Reads ahead files from the queue until it is empty and the walk has finished.
+        void read_ahead();
+
+        // Waits until reading 'size' more bytes doesn't exceed WARMUP_BYTES_PER_SEC.
+        // Returns 'false' if the warmer has been stopped in the meantime.
+        bool throttle(size_t size);
+
+    public:
+        Warmer() = default;
+
+        Warmer(const Warmer &) = delete;
+
+        Warmer &operator=(const Warmer &) = delete;
+
+        // Stops the warm-up (if it is still running) and waits for its threads.
+        ~Warmer();
+
+        // Starts warming files from 'base_directory' (which should be canonized) in background threads,
+        // beginning with request targets in 'hottest'.
+        void start(const std::string &base_directory, const std::vector<std::string> &hottest);
+    };
+}
+
+#endif //ZADANIE_1_WARMUP_H